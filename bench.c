@@ -0,0 +1,622 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define STATEMENT_SIZE 4096
+#define LINE_SIZE 8192
+
+// Benchmark driver and data generator for tinydb.
+//
+// `benchmark gen -n ROWS` prints a synthetic version of the input.txt schema,
+// scaled so that the schedule table has ROWS rows. `benchmark run` starts the
+// database in server mode in a scratch directory, loads the same data over a
+// Unix socket and times a set of scenarios, reporting throughput and latency
+// percentiles per scenario.
+
+typedef struct {
+    size_t schedules;
+    size_t employees;
+    size_t departments;
+    size_t shifts;
+    size_t needs;
+    size_t roles;
+    size_t weeks;
+} scale;
+
+typedef struct {
+    int fd;
+    FILE *in;
+} client;
+
+typedef struct {
+    const char *name;
+    size_t ops;
+    size_t rows;
+    size_t errors;
+    double seconds;
+    double *latencies;
+    size_t n_latencies;
+    size_t cap_latencies;
+} scenario;
+
+static const char *states[] = {
+        "AL", "AK", "AZ", "AR", "CA", "CO", "CT", "DE", "FL", "GA", "HI", "ID", "IL", "IN", "IA", "KS", "KY",
+        "LA", "ME", "MD", "MA", "MI", "MN", "MS", "MO", "MT", "NE", "NV", "NH", "NJ", "NM", "NY", "NC", "ND",
+        "OH", "OK", "OR", "PA", "RI", "SC", "SD", "TN", "TX", "UT", "VT", "VA", "WA", "WV", "WI", "WY",
+};
+
+static const char *dept_names[] = {
+        "ORTHOPEDIC", "SURGERY", "MEDICINE", "GYNECOLOGY", "PEADIATRIC", "CARDIOLOGY", "ONCOLOGY", "NEUROLOGY",
+};
+
+static const char *role_names[] = {
+        "ASSISTANT NURSE", "SENIOR NURSE", "HEAD NURSE", "UNIT HEAD NURSE", "DEPT HEAD NURSE", "MANAGER",
+};
+
+static const char *shift_timings[] = {
+        "7:30 AM - 3:30 PM", "3:30 PM - 11:30 PM", "11:30 PM - 7:30 AM",
+};
+
+static const char *schema =
+        "CREATE TABLE employee\n"
+        "ADD employee_id char 10\n"
+        "ADD last_name char 200\n"
+        "ADD first_name char 200\n"
+        "ADD middle_name char 200\n"
+        "ADD street_address char 1000\n"
+        "ADD state char 30\n"
+        "ADD zip char 10\n"
+        "ADD ft/pt char 50\n"
+        "ADD salary char 20\n"
+        "ADD home_phone char 50\n"
+        "ADD roles char 50\n"
+        "ADD certifications char 10\n"
+        "END\n"
+        "CREATE TABLE department\n"
+        "ADD dept_id char 10\n"
+        "ADD dept_name char 50\n"
+        "ADD no_of_beds char 10\n"
+        "ADD dept_need_id char 10\n"
+        "ADD dept_shift_id char 10\n"
+        "END\n"
+        "CREATE TABLE schedule\n"
+        "ADD schedule_id char 10\n"
+        "ADD schedule_shift_id char 10\n"
+        "ADD schedule_dept_id char 10\n"
+        "ADD schedule_need_id char 10\n"
+        "ADD date_of_shift char 30\n"
+        "ADD schedule_week_no char 10\n"
+        "ADD schedule_employee_id char 10\n"
+        "END\n"
+        "CREATE TABLE shift\n"
+        "ADD shift_id char 10\n"
+        "ADD shift_timing char 1000\n"
+        "ADD shift_overtime char 500\n"
+        "END\n"
+        "CREATE TABLE needs\n"
+        "ADD need_id char 10\n"
+        "ADD need_week_no char 10\n"
+        "ADD need_role_id char 10\n"
+        "ADD number_needed char 10\n"
+        "ADD need_certification char 10\n"
+        "END\n"
+        "CREATE TABLE roles\n"
+        "ADD role_id char 10\n"
+        "ADD role_name char 200\n"
+        "END\n";
+
+// The multi-way joins from input.txt.
+static const char *join_queries[] = {
+        "SELECT first_name, middle_name, last_name, date_of_shift, shift_timing, dept_name, role_name\n"
+        "FROM  schedule, employee, shift, department, roles\n"
+        "WHERE schedule_employee_id  = employee_id\n"
+        "AND  schedule_shift_id = shift_id\n"
+        "AND  schedule_dept_id = dept_id\n"
+        "AND roles = role_id\n"
+        "AND  schedule_week_no = \"2\"\n"
+        "END\n",
+        "SELECT dept_name, date_of_shift, shift_timing, role_name, number_needed\n"
+        "FROM department, schedule, shift, needs, roles\n"
+        "WHERE schedule_dept_id = dept_id\n"
+        "AND schedule_shift_id = shift_id\n"
+        "AND schedule_need_id = need_id\n"
+        "AND need_role_id = role_id\n"
+        "AND schedule_week_no = \"2\"\n"
+        "END\n",
+        "SELECT dept_name, date_of_shift, shift_timing, first_name, middle_name, last_name, home_phone\n"
+        "FROM department, schedule, employee, shift\n"
+        "WHERE schedule_dept_id = dept_id\n"
+        "AND schedule_shift_id = shift_id\n"
+        "AND schedule_employee_id = employee_id\n"
+        "AND schedule_week_no = \"2\"\n"
+        "END\n",
+        "SELECT dept_name, date_of_shift, shift_timing, salary\n"
+        "FROM department, schedule, employee, shift\n"
+        "WHERE schedule_dept_id = dept_id\n"
+        "AND schedule_shift_id = shift_id\n"
+        "AND schedule_employee_id = employee_id\n"
+        "AND schedule_week_no = \"2\"\n"
+        "END\n",
+};
+
+#define N_JOIN_QUERIES (sizeof(join_queries) / sizeof(join_queries[0]))
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+// Deterministic per-row pseudo random numbers, so every run loads the same data.
+uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+scale make_scale(size_t rows) {
+    scale s;
+    s.schedules = rows;
+    s.employees = rows / 100 > 10 ? rows / 100 : 10;
+    s.departments = rows / 10000 > 5 ? rows / 10000 : 5;
+    s.shifts = ARRAY_SIZE(shift_timings);
+    s.needs = 7;
+    s.roles = ARRAY_SIZE(role_names);
+    s.weeks = 52;
+    return s;
+}
+
+size_t total_rows(const scale *s) {
+    return s->schedules + s->employees + s->departments + s->shifts + s->needs + s->roles;
+}
+
+// Writes the INSERT for the n-th generated row, counting across all tables.
+void gen_insert(char *buf, const scale *s, size_t n) {
+    uint64_t r = mix(n);
+
+    if (n < s->roles) {
+        sprintf(buf, "INSERT INTO roles %zu,%s\n", n + 1, role_names[n]);
+        return;
+    }
+    n -= s->roles;
+
+    if (n < s->shifts) {
+        sprintf(buf, "INSERT INTO shift %zu,%s,%dHRS\n", n + 1, shift_timings[n], 1 + (int) (r % 2));
+        return;
+    }
+    n -= s->shifts;
+
+    if (n < s->needs) {
+        sprintf(buf, "INSERT INTO needs %zu,%zu,%zu,%zu,%zu\n", n + 1, 1 + r % s->weeks, 1 + (r >> 8) % s->roles,
+                5 + (r >> 16) % 30, 1 + (r >> 24) % 4);
+        return;
+    }
+    n -= s->needs;
+
+    if (n < s->departments) {
+        sprintf(buf, "INSERT INTO department %zu,%s%zu,%zu,%zu,%zu\n", n + 1,
+                dept_names[n % ARRAY_SIZE(dept_names)], n / ARRAY_SIZE(dept_names), 100 * (1 + r % 5),
+                1 + (r >> 8) % s->needs, 1 + (r >> 16) % s->shifts);
+        return;
+    }
+    n -= s->departments;
+
+    if (n < s->employees) {
+        sprintf(buf, "INSERT INTO employee %zu,LAST%zu,FIRST%zu,n/a,%zu MAIN STREET,%s,%05zu,%s,%zu,"
+                     "%03zu-%03zu-%04zu,%zu,%zu\n",
+                n + 1, r % 100000, (r >> 17) % 100000, 1 + (r >> 5) % 9999, states[(r >> 11) % ARRAY_SIZE(states)],
+                (r >> 23) % 100000, (r >> 40) % 5 == 0 ? "PT" : "FT", 50000 + (r >> 29) % 150000,
+                200 + (r >> 13) % 800, (r >> 19) % 1000, (r >> 37) % 10000, 1 + (r >> 43) % s->roles,
+                1 + (r >> 47) % 4);
+        return;
+    }
+    n -= s->employees;
+
+    // schedules are loaded in time order, one block of rows per week
+    size_t week = 1 + n * s->weeks / s->schedules;
+    size_t day = (week - 1) * 7 + (r >> 3) % 7;
+    sprintf(buf, "INSERT INTO schedule %zu,%zu,%zu,%zu,%02zu/%02zu/2017,%zu,%zu\n", n + 1, 1 + r % s->shifts,
+            1 + (r >> 9) % s->departments, 1 + (r >> 21) % s->needs, 1 + day / 28 % 12, 1 + day % 28, week,
+            1 + (r >> 31) % s->employees);
+}
+
+int generate(size_t rows) {
+    scale s = make_scale(rows);
+    char buf[STATEMENT_SIZE];
+
+    fputs(schema, stdout);
+    for (size_t i = 0; i < total_rows(&s); i++) {
+        gen_insert(buf, &s, i);
+        fputs(buf, stdout);
+    }
+    return 0;
+}
+
+bool client_connect(client *c, const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    c->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (c->fd == -1 || connect(c->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        if (c->fd != -1) {
+            close(c->fd);
+        }
+        return false;
+    }
+
+    c->in = fdopen(dup(c->fd), "r");
+    return true;
+}
+
+void client_close(client *c) {
+    fclose(c->in);
+    close(c->fd);
+}
+
+// Sends one statement and reads the response; returns the number of result
+// lines, or -1 when the server reported an error.
+long client_execute(client *c, const char *statement) {
+    size_t len = strlen(statement);
+    while (len > 0) {
+        ssize_t n = write(c->fd, statement, len);
+        if (n <= 0) {
+            return -1;
+        }
+        statement += n;
+        len -= n;
+    }
+
+    char line[LINE_SIZE];
+    long rows = 0;
+    while (fgets(line, LINE_SIZE, c->in) != NULL) {
+        if (strcmp(line, ".OK\n") == 0) {
+            return rows;
+        } else if (strcmp(line, ".ERROR\n") == 0) {
+            return -1;
+        }
+        // a line longer than the buffer is still one row
+        if (strchr(line, '\n') != NULL) {
+            rows++;
+        }
+    }
+    return -1;
+}
+
+void scenario_record(scenario *sc, double latency) {
+    if (sc->n_latencies == sc->cap_latencies) {
+        sc->cap_latencies = sc->cap_latencies == 0 ? 1024 : 2 * sc->cap_latencies;
+        sc->latencies = realloc(sc->latencies, sc->cap_latencies * sizeof(double));
+    }
+    sc->latencies[sc->n_latencies++] = latency;
+}
+
+// Times one statement into a scenario.
+void timed(client *c, scenario *sc, const char *statement) {
+    double start = now();
+    long rows = client_execute(c, statement);
+    double latency = now() - start;
+
+    sc->ops++;
+    sc->seconds += latency;
+    if (rows < 0) {
+        sc->errors++;
+    } else {
+        sc->rows += rows;
+    }
+    scenario_record(sc, latency);
+}
+
+int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+double percentile(const scenario *sc, double p) {
+    if (sc->n_latencies == 0) {
+        return 0;
+    }
+    return sc->latencies[(size_t) (p * (sc->n_latencies - 1) + 0.5)] * 1000;
+}
+
+void report_header(void) {
+    printf("%-16s %9s %10s %8s %11s %11s %9s %9s %9s %9s %6s\n", "scenario", "ops", "rows", "secs", "ops/s",
+           "rows/s", "p50 ms", "p95 ms", "p99 ms", "max ms", "errors");
+}
+
+void report(scenario *sc) {
+    qsort(sc->latencies, sc->n_latencies, sizeof(double), compare_double);
+    double secs = sc->seconds > 0 ? sc->seconds : 1e-9;
+    printf("%-16s %9zu %10zu %8.2f %11.1f %11.1f %9.3f %9.3f %9.3f %9.3f %6zu\n", sc->name, sc->ops, sc->rows,
+           sc->seconds, sc->ops / secs, sc->rows / secs, percentile(sc, 0.50), percentile(sc, 0.95),
+           percentile(sc, 0.99), percentile(sc, 1.0), sc->errors);
+    fflush(stdout);
+    free(sc->latencies);
+}
+
+typedef struct {
+    const char *socket;
+    const scale *scale;
+    bool writer;
+    int id;
+    size_t ops;
+    scenario result;
+} mixed_client;
+
+// One client of the mixed scenario: writers append schedules past the loaded
+// data, readers run the single-table filter.
+void *mixed_worker(void *arg) {
+    mixed_client *m = arg;
+    client c;
+    char buf[STATEMENT_SIZE];
+
+    if (!client_connect(&c, m->socket)) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < m->ops; i++) {
+        if (m->writer) {
+            size_t id = m->scale->schedules + (size_t) m->id * m->ops + i + 1;
+            uint64_t r = mix(id);
+            sprintf(buf, "INSERT INTO schedule %zu,%zu,%zu,%zu,12/31/2017,%zu,%zu\n", id, 1 + r % m->scale->shifts,
+                    1 + (r >> 9) % m->scale->departments, 1 + (r >> 21) % m->scale->needs, m->scale->weeks + 1,
+                    1 + (r >> 31) % m->scale->employees);
+        } else {
+            sprintf(buf, "SELECT employee_id, last_name, first_name\nFROM employee\nWHERE state = \"%s\"\nEND\n",
+                    states[mix(m->id * 7919 + i) % ARRAY_SIZE(states)]);
+        }
+        timed(&c, &m->result, buf);
+    }
+
+    client_close(&c);
+    return NULL;
+}
+
+void run_mixed(const char *socket, const scale *s, int n_clients, size_t ops) {
+    mixed_client clients[n_clients];
+    pthread_t threads[n_clients];
+
+    double start = now();
+    for (int i = 0; i < n_clients; i++) {
+        memset(&clients[i], 0, sizeof(mixed_client));
+        clients[i].socket = socket;
+        clients[i].scale = s;
+        clients[i].writer = i % 2 == 0;
+        clients[i].id = i;
+        clients[i].ops = ops;
+        pthread_create(&threads[i], NULL, mixed_worker, &clients[i]);
+    }
+    for (int i = 0; i < n_clients; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = now() - start;
+
+    scenario reads = {.name = "mixed read"};
+    scenario writes = {.name = "mixed write"};
+    for (int i = 0; i < n_clients; i++) {
+        scenario *into = clients[i].writer ? &writes : &reads;
+        for (size_t j = 0; j < clients[i].result.n_latencies; j++) {
+            scenario_record(into, clients[i].result.latencies[j]);
+        }
+        into->ops += clients[i].result.ops;
+        into->rows += clients[i].result.rows;
+        into->errors += clients[i].result.errors;
+        free(clients[i].result.latencies);
+    }
+
+    // throughput of concurrent clients is measured against wall time
+    reads.seconds = elapsed;
+    writes.seconds = elapsed;
+    report(&reads);
+    report(&writes);
+}
+
+pid_t start_server(const char *database, const char *dir, const char *socket, int workers) {
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        char address[FILENAME_MAX + 8];
+        char n_workers[16];
+        sprintf(address, "unix:%s", socket);
+        sprintf(n_workers, "%d", workers);
+        if (chdir(dir) == -1) {
+            perror("chdir");
+            _exit(1);
+        }
+        execl(database, database, "--listen", address, "--workers", n_workers, (char *) NULL);
+        perror("Error starting database");
+        _exit(1);
+    }
+
+    return pid;
+}
+
+int run(const char *database, const char *dir, size_t rows, int repeat, int join_repeat, int n_clients,
+        int workers) {
+    char path[FILENAME_MAX];
+    char socket[FILENAME_MAX];
+    char buf[STATEMENT_SIZE];
+    scale s = make_scale(rows);
+
+    // the server runs in dir, so it needs an absolute path to the binary
+    if (realpath(database, path) == NULL) {
+        perror(database);
+        return 1;
+    }
+    mkdir(dir, 0755);
+    if (realpath(dir, socket) == NULL) {
+        perror(dir);
+        return 1;
+    }
+    strncat(socket, "/bench.sock", sizeof(socket) - strlen(socket) - 1);
+
+    pid_t server = start_server(path, dir, socket, workers);
+
+    client c;
+    int attempts = 0;
+    while (!client_connect(&c, socket)) {
+        if (++attempts > 500) {
+            fputs("Could not connect to the database\n", stderr);
+            kill(server, SIGTERM);
+            return 1;
+        }
+        usleep(10000);
+    }
+
+    printf("rows: %zu schedules, %zu employees, %zu departments (%zu total)\n\n", s.schedules, s.employees,
+           s.departments, total_rows(&s));
+    report_header();
+
+    scenario create = {.name = "create table"};
+    const char *p = schema;
+    while (*p != 0) {
+        const char *end = strstr(p, "END\n") + 4;
+        memcpy(buf, p, end - p);
+        buf[end - p] = 0;
+        timed(&c, &create, buf);
+        p = end;
+    }
+    report(&create);
+
+    scenario insert = {.name = "bulk insert"};
+    for (size_t i = 0; i < total_rows(&s); i++) {
+        gen_insert(buf, &s, i);
+        timed(&c, &insert, buf);
+    }
+    insert.rows = insert.ops - insert.errors;
+    report(&insert);
+
+    scenario filter = {.name = "filter employee"};
+    for (int i = 0; i < repeat; i++) {
+        sprintf(buf, "SELECT employee_id, last_name, first_name\nFROM employee\nWHERE state = \"%s\"\nEND\n",
+                states[mix(i) % ARRAY_SIZE(states)]);
+        timed(&c, &filter, buf);
+    }
+    report(&filter);
+
+    scenario week = {.name = "filter week"};
+    for (int i = 0; i < repeat; i++) {
+        sprintf(buf, "SELECT schedule_id, date_of_shift\nFROM schedule\nWHERE schedule_week_no = \"%zu\"\nEND\n",
+                1 + mix(i) % s.weeks);
+        timed(&c, &week, buf);
+    }
+    report(&week);
+
+    scenario index = {.name = "create index"};
+    for (int i = 0; i < (repeat < 3 ? repeat : 3); i++) {
+        timed(&c, &index, "CREATE INDEX ischedule USING schedule_employee_id, schedule_shift_id, schedule_dept_id, "
+                          "schedule_week_no, schedule_need_id\nFROM schedule\nEND\n");
+    }
+    report(&index);
+
+    scenario lookup = {.name = "index lookup"};
+    for (int i = 0; i < repeat; i++) {
+        sprintf(buf, "SELECT schedule_employee_id, schedule_shift_id, schedule_dept_id\nFROM ischedule\n"
+                     "WHERE schedule_employee_id = \"%zu\"\nEND\n", 1 + mix(i) % s.employees);
+        timed(&c, &lookup, buf);
+    }
+    report(&lookup);
+
+    char name[N_JOIN_QUERIES][16];
+    for (size_t q = 0; q < N_JOIN_QUERIES; q++) {
+        sprintf(name[q], "join %zu", q + 1);
+        scenario join = {.name = name[q]};
+        for (int i = 0; i < join_repeat; i++) {
+            timed(&c, &join, join_queries[q]);
+        }
+        report(&join);
+    }
+
+    if (n_clients > 0) {
+        run_mixed(socket, &s, n_clients, (size_t) repeat);
+    }
+
+    client_execute(&c, "QUIT\n");
+    client_close(&c);
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    unlink(socket);
+    return 0;
+}
+
+void usage(const char *name) {
+    fprintf(stderr, "Usage: %s gen [-n rows]\n"
+                    "       %s run [-n rows] [-r repeat] [-j join repeat] [-c clients] [-w workers]\n"
+                    "              [-d dir] [-b database]\n", name, name);
+}
+
+int main(int argc, char *argv[]) {
+    size_t rows = 1000000;
+    int repeat = 10;
+    int join_repeat = 3;
+    int n_clients = 4;
+    int workers = 4;
+    const char *dir = "bench_data";
+    const char *database = "./database";
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "n:r:j:c:w:d:b:")) != -1) {
+        switch (opt) {
+            case 'n':
+                rows = strtoull(optarg, NULL, 10);
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                break;
+            case 'j':
+                join_repeat = atoi(optarg);
+                break;
+            case 'c':
+                n_clients = atoi(optarg);
+                break;
+            case 'w':
+                workers = atoi(optarg);
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            case 'b':
+                database = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (rows == 0) {
+        rows = 1;
+    }
+
+    if (strcmp(argv[1], "gen") == 0) {
+        return generate(rows);
+    } else if (strcmp(argv[1], "run") == 0) {
+        return run(database, dir, rows, repeat, join_repeat, n_clients, workers);
+    }
+
+    usage(argv[0]);
+    return 1;
+}
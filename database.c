@@ -1,9 +1,26 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
 
 //#define DEBUG
 #define QUIET
@@ -14,6 +31,44 @@
 #define MAX_TABLE_FIELDS 32
 #define MAX_FIELD_LENGTH 2048
 #define SELECT_MAX 32
+#define MAX_TABLE_INDEXES 64
+#define STATS_MAX_OPS 128
+#define SCAN_BATCH 1024
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+#define OUTPUT_BATCH_ROWS 4096
+#define LATENCY_BUCKETS 32
+
+#define DATA_HEADER_SIZE 64
+
+#define CACHE_PAGE_SIZE 65536
+#define CACHE_PAGES 1024
+#define CACHE_BUCKETS 4099
+
+#define READ_AHEAD_PAGES 8
+#define READ_AHEAD_DEPTH 64
+#define READ_AHEAD_THREADS 4
+
+#define DICT_MAX_ENTRIES 65535
+#define DICT_CHUNK_ENTRIES 256
+#define DICT_SLOTS (1 << 17)
+#define NOT_ENCODED (-2)
+
+#define ZONE_PREFIX 16
+#define ZONE_BLOOM_BITS 256
+
+#define HASH_PAGE_SIZE 4096
+#define HASH_MIN_PAGE_ENTRIES 4
+#define HASH_MAGIC "DBHASH01"
+
+#define BLOOM_BITS_PER_KEY 8
+#define BLOOM_HASHES 3
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+
+#define SERVER_BACKLOG 128
+#define SERVER_MAX_EVENTS 64
+#define SERVER_STACK_SIZE (8 * 1024 * 1024)
 
 #define starts_with(x, y) (strncmp(x, y, strlen(x)) == 0)
 
@@ -27,22 +82,255 @@ typedef struct {
     char name[MAX_FIELD_NAME_SIZE];
     size_t length;
     field_type type;
+    bool dictionary;
 } field;
 
+// Distinct values of a dictionary-encoded char column, whose rows store a
+// uint16_t code instead of the value. Entries are only ever appended, under
+// the table's append lock, and published before any row that uses them, so
+// readers decode and look up values without locking.
+typedef struct {
+    size_t width;
+    size_t n_entries;
+    char *chunks[DICT_MAX_ENTRIES / DICT_CHUNK_ENTRIES + 1];
+    uint16_t *slots;
+} dictionary;
+
 typedef struct {
     char name[MAX_TABLE_NAME_SIZE];
     int n_fields;
     field fields[MAX_TABLE_FIELDS];
-    size_t n_rows;
+    size_t n_rows;  // on disk only for indexes; a table's data file holds its count
+    bool compressed;
 } table_info;
 
+// Summary of one column over a block of rows: the smallest and largest key
+// (see zone_key) and a bloom filter of the values. Scans skip a block when
+// its zones show that no row can match an equality condition.
+typedef struct {
+    uint8_t min[ZONE_PREFIX];
+    uint8_t max[ZONE_PREFIX];
+    uint64_t bloom[ZONE_BLOOM_BITS / 64];
+} zone;
+
+// A hash index keeps entries of the values of its fields followed by the
+// uint64_t id of their row, hashed on the first field. <index>.hash holds a
+// header page and then one page per bucket of a linear hash; the pages a
+// bucket overflows into are in <index>.hash.ovf, numbered from 1.
+typedef struct {
+    char magic[8];
+    table_info info;  // of the entries; named after the table
+    uint64_t page_size;
+    uint64_t level;
+    uint64_t split;  // buckets below split have been split at this level
+    uint64_t n_entries;
+    uint64_t n_overflow;
+    uint64_t free_overflow;
+} hash_header;
+
 typedef struct {
+    uint32_t count;
+    uint32_t overflow;
+} hash_page;
+
+typedef struct hash_index {
+    char name[MAX_TABLE_NAME_SIZE];
+    int fd;
+    int overflow_fd;
+    hash_header header;
+    size_t entry_size;
+    size_t page_entries;
+    int n_cols;
+    int cols[MAX_TABLE_FIELDS];
+    struct hash_index *next;
+} hash_index;
+
+// Compares column col of n consecutive rows with a key stored the way the
+// column stores it, and ands (or ors) the results into selected.
+typedef void (*column_filter)(const uint8_t *rows, size_t n, const uint8_t *key, bool *selected, bool and);
+
+// Filters generated by --codegen for one row layout, with the row size and
+// every offset and type compiled in; a table uses them when the fingerprint
+// of its layout matches (see schema_fingerprint).
+typedef struct {
+    uint64_t fingerprint;
+    column_filter filters[MAX_TABLE_FIELDS];
+} schema_codec;
+
+#ifdef SCHEMA_CODECS
+#include "codecs.h"
+#else
+static const schema_codec *const schema_codecs[] = {NULL};
+#endif
+
+// Location of a sealed block of a compressed table in its .zblk file; the
+// .zdir file holds one entry per block, in block order.
+typedef struct {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t raw;
+} block_entry;
+
+// Precedes each block of a compressed index file.
+typedef struct {
+    uint32_t size;
+    uint32_t length;
+    uint32_t raw;
+} block_header;
+
+// Shared, cached state of an on-disk table. One handle per table lives in the
+// catalog and is shared by every session; queries work on private table views.
+//
+// Rows are append-only, so a view is a snapshot: it sees the rows committed
+// when it was opened and never waits for inserts. Inserts hold the schema lock
+// shared and the append lock; replacing the table holds the schema lock
+// exclusively and marks the handle dropped.
+//
+// Deleting a row sets its bit in the tombstone bitmap, kept in <table>.del;
+// views copy the bitmap when opened. An update appends the new version of a
+// row and deletes the old one. VACUUM rewrites the table without its deleted
+// rows, holding the schema lock exclusively like a replace.
+//
+// A compressed table keeps each full page-sized block of rows compressed in its
+// block file, and only the block still being filled uncompressed in .bin. The
+// block is sealed when the first row of the next block is inserted.
+typedef struct table_handle {
+    table_info info;
+    int id;
+    int fd;
+    int block_fd;
+    int dir_fd;
+    size_t sealed_blocks;
+    off_t block_end;
+    int dict_fd;
+    off_t dict_end;
+    dictionary *dicts[MAX_TABLE_FIELDS];
+    int zone_fd;
+    size_t zone_size;
+    size_t n_zone_blocks;
+    size_t zone_capacity;
+    uint8_t *zones;
+    pthread_mutex_t zone_lock;
+    int del_fd;
+    uint8_t *deleted;
+    size_t deleted_size;
+    size_t n_deleted;
+    pthread_mutex_t delete_lock;
+    hash_index *hash_indexes;
+    const schema_codec *codec;
+    int refs;
+    size_t row_size;
+    size_t rows_per_page;
+    size_t committed_rows;
+    bool dropped;
+    pthread_rwlock_t schema_lock;
+    pthread_mutex_t append_lock;
+    struct table_handle *next;
+} table_handle;
+
+// A cached page holds whole rows, so a field never straddles two pages.
+typedef struct page {
+    int handle;
+    size_t number;
+    uint8_t *data;
+    size_t capacity;
+    int pins;
+    bool loading;
+    bool stale;
+    bool referenced;
+    struct page *next;
+} page;
+
+typedef struct table {
     table_info info;
     bool temporary;
-    FILE *fp;
+    table_handle *handle;
+    page *page;
     uint8_t *data;
+    size_t capacity;
+    dictionary *dicts[MAX_TABLE_FIELDS];
+    size_t read_ahead;
+    uint8_t *deleted;
+    hash_index *hash;
+    struct table *source;
 } table;
 
+typedef enum {
+    read_ahead_off,
+    read_ahead_threads,
+    read_ahead_uring,
+} read_ahead_mode;
+
+// I/O, memory and work done by the statements of one thread. Operators report
+// the difference between the counters before and after they ran; SHOW STATS
+// reports the totals over all threads.
+typedef struct {
+    size_t bytes_read;
+    size_t page_reads;
+    size_t page_hits;
+    size_t pages_read_ahead;
+    size_t temp_bytes;
+    size_t peak_temp_bytes;
+    size_t blocks_skipped;
+    size_t rows_scanned;
+    size_t rows_codec_checked;
+    size_t cells_decoded;
+    size_t field_bytes_read;
+    size_t join_comparisons;
+    size_t index_probes;
+    size_t rows_inserted;
+    size_t rows_deleted;
+    size_t rows_updated;
+    size_t header_writes;
+} thread_counters;
+
+static __thread thread_counters counters;
+
+typedef enum {
+    statement_create_table,
+    statement_create_index,
+    statement_insert,
+    statement_delete,
+    statement_update,
+    statement_vacuum,
+    statement_select,
+    statement_explain,
+    statement_show,
+    statement_other,
+    statement_kinds,
+} statement_kind;
+
+// Counters and statement latencies of one thread, linked into a list so
+// SHOW STATS can add them up. Only the owning thread writes them.
+typedef struct thread_stats {
+    thread_counters *counters;
+    size_t latency[statement_kinds][LATENCY_BUCKETS];
+    bool registered;
+    struct thread_stats *next;
+} thread_stats;
+
+static __thread thread_stats own_stats;
+
+typedef enum {
+    output_text,
+    output_binary,
+} output_format;
+
+typedef struct {
+    FILE *in;
+    FILE *out;
+    output_format format;
+} session;
+
+// An equality condition on one column, ready to test against zones; col is
+// -1 when the condition cannot rule out any block.
+typedef struct {
+    int col;
+    bool never;
+    uint8_t key[ZONE_PREFIX];
+    uint64_t hash;
+} zone_probe;
+
 typedef struct {
     char table[MAX_TABLE_NAME_SIZE];
     char field[MAX_FIELD_NAME_SIZE];
@@ -92,7 +380,65 @@ typedef struct {
     bool *include_rows;
 } result_set;
 
-bool show_table_info(table_info t);
+// Bloom filter over join keys; mask + 1 bits, a power of two.
+typedef struct {
+    size_t mask;
+    uint64_t *bits;
+} bloom_filter;
+
+typedef enum {
+    explain_none,
+    explain_plan,
+    explain_analyze,
+} explain_mode;
+
+typedef enum {
+    path_single_query,
+    path_index_query,
+    path_hash_lookup,
+    path_join_query,
+} query_path;
+
+typedef struct {
+    query_path path;
+    int n_filters;
+    int filters[SELECT_MAX];
+    int n_joins;
+    int joins[SELECT_MAX];
+    bool merge[SELECT_MAX];
+    int n_semi_joins;
+    int semi_joins[SELECT_MAX * 2];
+} query_plan;
+
+typedef struct {
+    char name[24];
+    char detail[256];
+    double seconds;
+    size_t rows_in;
+    size_t rows_out;
+    thread_counters io;
+    thread_counters started_io;
+    double started;
+} operator_stats;
+
+typedef struct {
+    query_path path;
+    int n_ops;
+    operator_stats ops[STATS_MAX_OPS];
+    double seconds;
+    size_t rows;
+    size_t peak_temp_bytes;
+} query_stats;
+
+static struct {
+    pthread_mutex_t lock;
+    FILE *fp;
+} stats_log = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .fp = NULL,
+};
+
+bool show_table_info(session *s, table_info t);
 
 char *str_trim(char *str) {
     char *end;
@@ -167,24 +513,86 @@ bool write_table_info(const table_info *t) {
     printf("Writing table: %s Fields: %d Rows: %lu\n", t->name, t->n_fields, t->n_rows);
 #endif
 
-    char fname[MAX_TABLE_NAME_SIZE + 6];
+    char fname[FILENAME_MAX];
+    char tmp_name[FILENAME_MAX];
     sprintf(fname, "%s.table", t->name);
+    sprintf(tmp_name, "%s.table.tmp", t->name);
 
-    FILE *fp = fopen(fname, "w");
+    // Readers, in this process or another, see either the old or the new header.
+    FILE *fp = fopen(tmp_name, "w");
 
     if (fp == NULL) {
         return false;
     }
+    counters.header_writes++;
 
     fwrite(t, sizeof(table_info), 1, fp);
 
     if (ferror(fp)) {
+        fclose(fp);
         return false;
     }
 
     fclose(fp);
 
-    return true;
+    return rename(tmp_name, fname) == 0;
+}
+
+// Reads the names of the indexes built from a table, one per line in
+// <table>.indexes, so that loading a table finds them without listing the
+// directory. A name can outlive its index or be taken by an index of another
+// table; the header of the index tells.
+int read_table_indexes(const char *table_name, char names[][MAX_TABLE_NAME_SIZE], int max) {
+    char fname[FILENAME_MAX];
+    snprintf(fname, sizeof(fname), "%s.indexes", table_name);
+    FILE *fp = fopen(fname, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    int n = 0;
+    char line[MAX_TABLE_NAME_SIZE + 2];
+    while (n < max && fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = 0;
+        if (line[0] != 0) {
+            snprintf(names[n++], MAX_TABLE_NAME_SIZE, "%.*s", MAX_TABLE_NAME_SIZE - 1, line);
+        }
+    }
+    fclose(fp);
+    return n;
+}
+
+// Adds an index to the list of its table unless it is listed. Called with
+// index_lock held exclusively.
+bool add_table_index(const char *table_name, const char *index_name) {
+    char names[MAX_TABLE_INDEXES][MAX_TABLE_NAME_SIZE];
+    int n = read_table_indexes(table_name, names, MAX_TABLE_INDEXES);
+    for (int i = 0; i < n; i++) {
+        if (strcmp(names[i], index_name) == 0) {
+            return true;
+        }
+    }
+    if (n == MAX_TABLE_INDEXES) {
+        return false;
+    }
+    snprintf(names[n++], MAX_TABLE_NAME_SIZE, "%s", index_name);
+
+    char fname[FILENAME_MAX];
+    char tmp_name[FILENAME_MAX];
+    snprintf(fname, sizeof(fname), "%s.indexes", table_name);
+    snprintf(tmp_name, sizeof(tmp_name), "%s.indexes.tmp", table_name);
+    FILE *fp = fopen(tmp_name, "w");
+    if (fp == NULL) {
+        return false;
+    }
+    for (int i = 0; i < n; i++) {
+        fprintf(fp, "%s\n", names[i]);
+    }
+    if (fclose(fp) != 0) {
+        unlink(tmp_name);
+        return false;
+    }
+    return rename(tmp_name, fname) == 0;
 }
 
 int table_find_field(table_info t, const char *field_name) {
@@ -200,7 +608,7 @@ int table_find_field(table_info t, const char *field_name) {
 size_t field_size(field f) {
     switch (f.type) {
         case field_type_char:
-            return f.length + 1;
+            return f.dictionary ? sizeof(uint16_t) : f.length + 1;
         case field_type_integer:
             return sizeof(int64_t);
         case field_type_undefined:
@@ -237,811 +645,5509 @@ size_t seek_pos(const table_info t, size_t row, int col) {
     return mem_offset(t.n_fields, t.fields, row, col);
 }
 
-table *open_table(const char *name) {
-    table *t = (table *) malloc(sizeof(table));
-
-    //read_table_info(&t->info, name);
-    char fname[FILENAME_MAX];
-    sprintf(fname, "%s.table", name);
+void count_temp_bytes(size_t allocated, size_t freed) {
+    counters.temp_bytes += allocated - freed;
+    if (counters.temp_bytes > counters.peak_temp_bytes) {
+        counters.peak_temp_bytes = counters.temp_bytes;
+    }
+}
 
-    FILE *fp = fopen(fname, "rb");
+// Threads that ran statements, plus the totals of those that have exited.
+static struct {
+    pthread_mutex_t lock;
+    pthread_once_t once;
+    pthread_key_t key;
+    thread_stats *threads;
+    thread_counters retired_counters;
+    thread_stats retired;
+} stats_registry = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .once = PTHREAD_ONCE_INIT,
+        .retired = {.counters = &stats_registry.retired_counters},
+};
+
+void add_thread_stats(thread_stats *to, const thread_stats *from) {
+    size_t *dst = (size_t *) to->counters;
+    const size_t *src = (const size_t *) from->counters;
+    for (size_t i = 0; i < sizeof(thread_counters) / sizeof(size_t); i++) {
+        dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+    for (int k = 0; k < statement_kinds; k++) {
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            to->latency[k][b] += __atomic_load_n(&from->latency[k][b], __ATOMIC_RELAXED);
+        }
+    }
+}
 
-    if (NULL == fp) {
-        return false;
+void retire_thread_stats(void *arg) {
+    thread_stats *t = arg;
+    pthread_mutex_lock(&stats_registry.lock);
+    for (thread_stats **tp = &stats_registry.threads; *tp != NULL; tp = &(*tp)->next) {
+        if (*tp == t) {
+            *tp = t->next;
+            break;
+        }
     }
+    add_thread_stats(&stats_registry.retired, t);
+    pthread_mutex_unlock(&stats_registry.lock);
+}
 
-    fread(&t->info, sizeof(table_info), 1, fp);
-    fclose(fp);
+void create_stats_key(void) {
+    pthread_key_create(&stats_registry.key, retire_thread_stats);
+}
 
-    //char fname[MAX_TABLE_NAME_SIZE + 4];
-    sprintf(fname, "%s.bin", name);
+// Makes the counters of the calling thread visible to SHOW STATS.
+void register_thread_stats(void) {
+    if (own_stats.registered) {
+        return;
+    }
+    pthread_once(&stats_registry.once, create_stats_key);
+    own_stats.counters = &counters;
+    own_stats.registered = true;
+    pthread_setspecific(stats_registry.key, &own_stats);
+
+    pthread_mutex_lock(&stats_registry.lock);
+    own_stats.next = stats_registry.threads;
+    stats_registry.threads = &own_stats;
+    pthread_mutex_unlock(&stats_registry.lock);
+}
 
-    t->fp = fopen(fname, "a+");
+// Sums the counters and latencies of all threads into totals.
+void collect_thread_stats(thread_stats *totals) {
+    memset(totals->counters, 0, sizeof(thread_counters));
+    memset(totals->latency, 0, sizeof(totals->latency));
 
-    if (NULL == t->fp) {
-        perror("Error opening table");
-        //free(t);
-        return NULL;
+    pthread_mutex_lock(&stats_registry.lock);
+    add_thread_stats(totals, &stats_registry.retired);
+    for (thread_stats *t = stats_registry.threads; t != NULL; t = t->next) {
+        add_thread_stats(totals, t);
     }
-
-    return t;
+    pthread_mutex_unlock(&stats_registry.lock);
 }
 
-void close_table(table *t) {
-    fclose(t->fp);
-    free(t);
+// Latencies go into power-of-two buckets of microseconds: bucket b holds
+// statements that took less than 2^b us.
+void record_latency(statement_kind kind, double seconds) {
+    uint64_t us = (uint64_t) (seconds * 1e6);
+    int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    own_stats.latency[kind][bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
 }
 
-bool write_table_row(const table *t, size_t row, uint8_t *data) {
+dictionary *create_dictionary(size_t width) {
+    dictionary *d = calloc(1, sizeof(dictionary));
+    d->width = width;
+    d->slots = calloc(DICT_SLOTS, sizeof(uint16_t));
+    return d;
+}
 
-    fseek(t->fp, seek_pos(t->info, row, 0), SEEK_SET);
-    fwrite(data, sizeof(uint8_t), row_size(t->info), t->fp);
+void free_dictionary(dictionary *d) {
+    if (d == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < sizeof(d->chunks) / sizeof(d->chunks[0]); i++) {
+        free(d->chunks[i]);
+    }
+    free(d->slots);
+    free(d);
+}
 
-    if (ferror(t->fp)) {
-        return false;
+size_t dictionary_hash(const char *value) {
+    uint32_t hash = 2166136261u;
+    for (; *value; value++) {
+        hash = (hash ^ (uint8_t) *value) * 16777619u;
     }
-    //puts("Written");
-    return true;
+    return hash & (DICT_SLOTS - 1);
 }
 
-bool parse_create(const char *input) {
-    //puts("CREATE");
-    int n;
-    table_info t_info;
-    memset(&t_info, 0, sizeof(table_info));
-    t_info.n_fields = 0;
-    t_info.n_rows = 0;
-    n = sscanf(input, "CREATE TABLE %s", t_info.name);
+const char *dictionary_value(const dictionary *d, uint16_t code) {
+    return d->chunks[code / DICT_CHUNK_ENTRIES] + (code % DICT_CHUNK_ENTRIES) * d->width;
+}
 
-    if (n != 1) {
-        return false;
+// Returns the code of value, or -1 if no row holds it.
+int dictionary_find(const dictionary *d, const char *value) {
+    for (size_t i = dictionary_hash(value);; i = (i + 1) & (DICT_SLOTS - 1)) {
+        uint16_t slot = __atomic_load_n(&d->slots[i], __ATOMIC_ACQUIRE);
+        if (slot == 0) {
+            return -1;
+        }
+        if (strcmp(dictionary_value(d, slot - 1), value) == 0) {
+            return slot - 1;
+        }
     }
+}
 
-    char ib[INPUT_BUFFER_SIZE];
-    int i = 0;
-
-    do {
-        fgets(ib, INPUT_BUFFER_SIZE, stdin);
-        str_trim(ib);
+// Adds a value that is not in the dictionary yet and returns its code, or -1
+// when the dictionary is full. Writers hold the table's append lock.
+int dictionary_add(dictionary *d, const char *value) {
+    if (d->n_entries == DICT_MAX_ENTRIES) {
+        return -1;
+    }
 
-#ifndef QUIET
-        printf("===> %s\n", ib);
-#endif
+    size_t code = d->n_entries;
+    size_t chunk = code / DICT_CHUNK_ENTRIES;
+    if (d->chunks[chunk] == NULL) {
+        d->chunks[chunk] = calloc(DICT_CHUNK_ENTRIES, d->width);
+    }
+    strncpy(d->chunks[chunk] + (code % DICT_CHUNK_ENTRIES) * d->width, value, d->width - 1);
 
-        if (starts_with("ADD", ib)) {
-            char field_type[16];
-            n = sscanf(ib, "ADD %s %s %lu", t_info.fields[i].name, field_type, &t_info.fields[i].length);
-            if (n != 3) {
-                return false;
-            }
-            t_info.fields[i].type = str_to_field_type(field_type);
-            i++;
-            t_info.n_fields++;
-        }
+    size_t i = dictionary_hash(value);
+    while (d->slots[i] != 0) {
+        i = (i + 1) & (DICT_SLOTS - 1);
+    }
+    // the value is complete before its slot is visible to readers
+    __atomic_store_n(&d->slots[i], (uint16_t) (code + 1), __ATOMIC_RELEASE);
+    __atomic_store_n(&d->n_entries, code + 1, __ATOMIC_RELEASE);
+    return (int) code;
+}
 
-    } while (strcmp(ib, "END") != 0);
+uint16_t field_code(const uint8_t *raw) {
+    uint16_t code;
+    memcpy(&code, raw, sizeof(code));
+    return code;
+}
 
-    return write_table_info(&t_info);
+// The key a zone orders a value by: the first ZONE_PREFIX bytes of a char
+// value, or an integer or dictionary code as an int64_t.
+void zone_key(const field *f, const uint8_t *raw, uint8_t *key) {
+    memset(key, 0, ZONE_PREFIX);
+    if (f->type == field_type_char && !f->dictionary) {
+        strncpy((char *) key, (const char *) raw, ZONE_PREFIX);
+    } else {
+        int64_t value = 0;
+        if (f->dictionary) {
+            value = field_code(raw);
+        } else if (f->type == field_type_integer) {
+            memcpy(&value, raw, sizeof(value));
+        }
+        memcpy(key, &value, sizeof(value));
+    }
 }
 
-bool parse_insert(const char *input) {
-    char table_name[MAX_TABLE_NAME_SIZE];
-    char insert_data[INPUT_BUFFER_SIZE];
-    int n = sscanf(input, "INSERT INTO %s %[^\n]%*c", table_name, insert_data);
-    if (n != 2) {
-        return false;
+int zone_compare(const field *f, const uint8_t *a, const uint8_t *b) {
+    if (f->type == field_type_char && !f->dictionary) {
+        return strncmp((const char *) a, (const char *) b, ZONE_PREFIX);
     }
+    int64_t x;
+    int64_t y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return (x > y) - (x < y);
+}
 
-    table *t = open_table(table_name);
-    if (t != NULL) {
-        //show_table_info(&t);
-        uint8_t *values = calloc(row_size(t->info), 1);
+uint64_t hash_bytes(const void *data, size_t n) {
+    const uint8_t *bytes = data;
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < n; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211u;
+    }
+    return hash;
+}
 
-        int index = 0;
-        for (int i = 0; i < t->info.n_fields; i++) {
-            char *tok = strtok(i == 0 ? insert_data : NULL, ",");
+// Identifies the row layout of a table: the type and stored width of every
+// column. Names do not matter, so tables of the same layout share a codec.
+uint64_t schema_fingerprint(const table_info *t) {
+    char layout[MAX_TABLE_FIELDS * 48];
+    size_t n = 0;
+    for (int i = 0; i < t->n_fields; i++) {
+        n += (size_t) snprintf(layout + n, sizeof(layout) - n, "%d:%zu:%d;", (int) t->fields[i].type,
+                               t->fields[i].length, t->fields[i].dictionary);
+    }
+    return hash_bytes(layout, n);
+}
 
-            int64_t long_val;
-            size_t f_size = field_size(t->info.fields[i]);
-            switch (t->info.fields[i].type) {
-                case field_type_char:
-                    memcpy(values + index, tok, strlen(tok));
-                    break;
-                case field_type_integer:
-                    long_val = strtoll(tok, NULL, 10);
-                    memcpy(values + index, &long_val, f_size);
-                    break;
-                case field_type_undefined:
-                    // do nothing
-                    break;
-            }
-            index += f_size;
+const schema_codec *find_schema_codec(const table_info *t) {
+    uint64_t fingerprint = schema_fingerprint(t);
+    for (int i = 0; schema_codecs[i] != NULL; i++) {
+        if (schema_codecs[i]->fingerprint == fingerprint) {
+            return schema_codecs[i];
         }
-
-        write_table_row(t, t->info.n_rows++, values);
-        write_table_info(&(t->info));
-        close_table(t);
-        return true;
     }
+    return NULL;
+}
 
-    return false;
+uint64_t zone_hash(const field *f, const uint8_t *raw) {
+    size_t n = f->type == field_type_char && !f->dictionary ? strlen((const char *) raw) : field_size(*f);
+    return hash_bytes(raw, n);
 }
 
-bool parse_delete(const char *input) {
-    return true;
+bool zone_bloom_test(const zone *z, uint64_t hash) {
+    size_t bit1 = hash % ZONE_BLOOM_BITS;
+    size_t bit2 = (hash >> 32) % ZONE_BLOOM_BITS;
+    return (z->bloom[bit1 / 64] >> (bit1 % 64) & 1) && (z->bloom[bit2 / 64] >> (bit2 % 64) & 1);
 }
 
-void decode_field(char *output, const uint8_t *raw, field_type f) {
-    switch (f) {
-        case field_type_char:
-            strcpy(output, (char *) raw);
-            break;
-        case field_type_integer:
-            sprintf(output, "%" PRIi64, *((int64_t *) raw));
-        case field_type_undefined:
-            sprintf(output, "undefined");
-    }
+// Sets the two bloom bits of a hash; returns whether they were not both set.
+bool zone_bloom_add(zone *z, uint64_t hash) {
+    bool present = zone_bloom_test(z, hash);
+    size_t bit1 = hash % ZONE_BLOOM_BITS;
+    size_t bit2 = (hash >> 32) % ZONE_BLOOM_BITS;
+    z->bloom[bit1 / 64] |= (uint64_t) 1 << (bit1 % 64);
+    z->bloom[bit2 / 64] |= (uint64_t) 1 << (bit2 % 64);
+    return !present;
 }
 
-bool read_field(uint8_t *raw, const table *t, size_t row, int col) {
-    size_t size = field_size(t->info.fields[col]);
-    fseek(t->fp, seek_pos(t->info, row, col), SEEK_SET);
-    fread(raw, size, 1, t->fp);
+// Widens a zone to cover a value; returns whether the zone changed.
+bool zone_add(zone *z, const field *f, const uint8_t *raw) {
+    uint8_t key[ZONE_PREFIX];
+    zone_key(f, raw, key);
 
-    return !ferror(t->fp);
+    bool changed = zone_bloom_add(z, zone_hash(f, raw));
+    if (zone_compare(f, key, z->min) < 0) {
+        memcpy(z->min, key, ZONE_PREFIX);
+        changed = true;
+    }
+    if (zone_compare(f, key, z->max) > 0) {
+        memcpy(z->max, key, ZONE_PREFIX);
+        changed = true;
+    }
+    return changed;
 }
 
-table *create_temp_table(int n_fields, field fields[], size_t n_rows) {
-    table *temp = malloc(sizeof(table));
-    temp->data = malloc(row_size_2(n_fields, fields) * n_rows * sizeof(uint8_t));
-    temp->info.n_rows = 0;
-    temp->info.n_fields = n_fields;
-    temp->temporary = true;
-    memcpy(temp->info.fields, fields, sizeof(field) * n_fields);
-    return temp;
+void zone_init(zone *z, const field *f, const uint8_t *raw) {
+    memset(z, 0, sizeof(zone));
+    zone_key(f, raw, z->min);
+    memcpy(z->max, z->min, ZONE_PREFIX);
+    zone_bloom_add(z, zone_hash(f, raw));
 }
 
-void set_temp_table_field(table *t, size_t row, int col, uint8_t *value) {
-    size_t offset = mem_offset(t->info.n_fields, t->info.fields, row, col);
-    memcpy(t->data + offset, value, field_size(t->info.fields[col]));
+// Prepares an equality test of column col against value for zone_may_contain.
+void zone_probe_init(zone_probe *p, const table *t, int col, const char *value) {
+    const field *f = &t->info.fields[col];
+    uint8_t raw[MAX_FIELD_LENGTH + 1] = {0};
+
+    p->col = col;
+    p->never = false;
+    if (f->dictionary) {
+        int code = dictionary_find(t->dicts[col], value);
+        p->never = code == -1;
+        uint16_t stored = (uint16_t) code;
+        memcpy(raw, &stored, sizeof(stored));
+    } else if (f->type == field_type_integer) {
+        int64_t v = strtoll(value, NULL, 10);
+        memcpy(raw, &v, sizeof(v));
+    } else {
+        strncpy((char *) raw, value, MAX_FIELD_LENGTH);
+    }
+    zone_key(f, raw, p->key);
+    p->hash = zone_hash(f, raw);
 }
 
-void decode_temp_table_field(char *dest, table *t, size_t row, int col) {
-    size_t offset = mem_offset(t->info.n_fields, t->info.fields, row, col);
-    uint8_t *value = alloca(field_size(t->info.fields[col]));
-    memcpy(value, t->data + offset, field_size(t->info.fields[col]));
-    decode_field(dest, value, t->info.fields[col].type);
+bool zone_may_contain(const zone *z, const field *f, const zone_probe *p) {
+    return !p->never && zone_compare(f, p->key, z->min) >= 0 && zone_compare(f, p->key, z->max) <= 0 &&
+           zone_bloom_test(z, p->hash);
 }
 
-bool index_query(query q) {
-    // only binary search for 1 row
-    table *t = q.tables[0];
-    char buf[MAX_FIELD_LENGTH];
-
-    if(q.n_conditions > 0) {
-        query_condition c = q.conditions[0];
+// Blocks are compressed with a small LZ77 codec in the LZ4 block layout: each
+// sequence is a token holding the literal count and match length (4 bits each,
+// continued in 255-valued bytes when they reach 15), the literals, and a 16-bit
+// little-endian offset back into the output. The last sequence has no match.
+// NUL padding and repeated values in fixed-width rows become short matches.
+size_t lz_bound(size_t size) {
+    return size + size / 255 + 16;
+}
 
-        size_t l = 0;
-        size_t r = t->info.n_rows - 1;
-        while (l <= r) {
-            size_t m = l + (r - l) / 2;
+uint8_t *lz_put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
 
-            printf("TRACE: ");
-            for (int j = 0; j < q.n_fields; j++) {
-                decode_temp_table_field(buf, t, m, q.fields[j].col);
-                printf("%s%s", j == 0 ? "" : ",", buf);
-            }
-            puts("");
+uint8_t *lz_put_sequence(uint8_t *op, const uint8_t *literals, size_t n_literals, size_t match) {
+    *op++ = (uint8_t) ((n_literals < 15 ? n_literals : 15) << 4 | (match < 15 ? match : 15));
+    if (n_literals >= 15) {
+        op = lz_put_length(op, n_literals - 15);
+    }
+    memcpy(op, literals, n_literals);
+    return op + n_literals;
+}
 
-            decode_temp_table_field(buf, t, m, 0);
-            int diff = strcmp(c.literal2.value, buf);
-            // Check if x is present at mid
-            if (diff == 0) {
-                for (int j = 0; j < q.n_fields; j++) {
-                    decode_temp_table_field(buf, t, m, q.fields[j].col);
-                    printf("%s%s", j == 0 ? "" : ",", buf);
-                }
-                puts("");
-                return true;
-            }
+// Returns the compressed size; dst must hold lz_bound(size) bytes.
+size_t lz_compress(const uint8_t *src, size_t size, uint8_t *dst) {
+    uint32_t positions[1 << LZ_HASH_BITS] = {0};
+    uint8_t *op = dst;
+    size_t anchor = 0;
+    size_t ip = 0;
+
+    while (ip + LZ_MIN_MATCH <= size) {
+        uint32_t seq;
+        memcpy(&seq, src + ip, sizeof(seq));
+        uint32_t hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t ref = positions[hash];
+        positions[hash] = (uint32_t) ip + 1;
+
+        if (ref-- == 0 || ip - ref > UINT16_MAX || memcmp(src + ref, src + ip, LZ_MIN_MATCH) != 0) {
+            ip++;
+            continue;
+        }
 
-            if (diff > 0) {
-                l = m + 1;
-            } else {
-                r = m - 1;
-            }
+        size_t len = LZ_MIN_MATCH;
+        while (ip + len < size && src[ref + len] == src[ip + len]) {
+            len++;
         }
-    } else {
-        for (int i = 0; i < t->info.n_rows ; ++i) {
-            for (int j = 0; j < q.n_fields; j++) {
-                decode_temp_table_field(buf, t, i, q.fields[j].col);
-                printf("%s%s", j == 0 ? "" : ",", buf);
-            }
-            puts("");
+
+        op = lz_put_sequence(op, src + anchor, ip - anchor, len - LZ_MIN_MATCH);
+        *op++ = (uint8_t) (ip - ref);
+        *op++ = (uint8_t) ((ip - ref) >> 8);
+        if (len - LZ_MIN_MATCH >= 15) {
+            op = lz_put_length(op, len - LZ_MIN_MATCH - 15);
         }
+
+        ip += len;
+        anchor = ip;
     }
 
+    op = lz_put_sequence(op, src + anchor, size - anchor, 0);
+    return op - dst;
 }
 
-bool single_query(query q) {
-    table *t = q.tables[0];
+bool lz_get_length(const uint8_t *src, size_t n, size_t *ip, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= n) {
+            return false;
+        }
+        b = src[(*ip)++];
+        *len += b;
+    } while (b == 255);
+    return true;
+}
 
-    if (t->temporary) {
-        return index_query(q);
-    }
+// Decompresses exactly size bytes; false if the input is corrupt.
+bool lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t size) {
+    size_t ip = 0;
+    size_t op = 0;
 
-    uint8_t data[MAX_FIELD_LENGTH];
+    while (ip < n) {
+        uint8_t token = src[ip++];
 
-    for (size_t i = 0; i < t->info.n_rows; i++) {
-        // condition
-        bool accept = true;
-        for (int k = 0; k < q.n_conditions; k++) {
-            char val1[MAX_FIELD_LENGTH];
-            char val2[MAX_FIELD_LENGTH];
-
-            if (q.conditions[k].literal1.type == literal_type_field) {
-                read_field(data, t, i, q.conditions[k].literal1.col);
-                field_type type = t->info.fields[q.conditions[k].literal1.col].type;
-                decode_field(val1, data, type);
-            } else {
-                strcpy(val1, q.conditions[k].literal1.value);
-                val1[strlen(val1) - 1] = 0;
-            }
-
-            if (q.conditions[k].literal2.type == literal_type_field) {
-                read_field(data, t, i, q.conditions[k].literal2.col);
-                field_type type = t->info.fields[q.conditions[k].literal2.col].type;
-                decode_field(val2, data, type);
-            } else {
-                strcpy(val2, q.conditions[k].literal2.value);
-            }
+        size_t n_literals = token >> 4;
+        if (n_literals == 15 && !lz_get_length(src, n, &ip, &n_literals)) {
+            return false;
+        }
+        if (n_literals > n - ip || n_literals > size - op) {
+            return false;
+        }
+        memcpy(dst + op, src + ip, n_literals);
+        ip += n_literals;
+        op += n_literals;
 
-            // since we only support equals now
-            bool result = strcmp(val1, val2) == 0;
+        if (ip == n) {
+            break;
+        }
 
-            accept = q.conditions[k].conjunction == conjunction_and ? accept && result : accept || result;
+        if (n - ip < 2) {
+            return false;
+        }
+        size_t offset = src[ip] | (size_t) src[ip + 1] << 8;
+        ip += 2;
 
+        size_t len = token & 15;
+        if (len == 15 && !lz_get_length(src, n, &ip, &len)) {
+            return false;
+        }
+        len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || len > size - op) {
+            return false;
         }
 
-        if (!accept) {
-            continue;
+        // the match may overlap the bytes it produces
+        if (offset >= len) {
+            memcpy(dst + op, dst + op - offset, len);
+        } else if (offset == 1) {
+            memset(dst + op, dst[op - 1], len);
+        } else {
+            // repeat the period, doubling the copy each time
+            for (size_t done = 0; done < len;) {
+                size_t n = offset + done < len - done ? offset + done : len - done;
+                memcpy(dst + op + done, dst + op - offset, n);
+                done += n;
+            }
         }
+        op += len;
+    }
+
+    return op == size;
+}
 
-        for (int j = 0; j < q.n_fields; j++) {
-            //uint8_t data[MAX_FIELD_LENGTH];
-            char decoded[MAX_FIELD_LENGTH];
-            read_field(data, t, i, q.fields[j].col);
-            field_type type = t->info.fields[q.fields[j].col].type;
-            decode_field(decoded, data, type);
-            printf("%s%s", j == 0 ? "" : ",", decoded);
+// Writes data as a run of blocks, each a block_header and its stored bytes.
+bool write_blocks(FILE *fp, const uint8_t *data, size_t size) {
+    uint8_t *packed = malloc(lz_bound(CACHE_PAGE_SIZE));
+    bool ok = true;
+
+    for (size_t pos = 0; ok && pos < size; pos += CACHE_PAGE_SIZE) {
+        block_header header;
+        header.size = size - pos < CACHE_PAGE_SIZE ? size - pos : CACHE_PAGE_SIZE;
+        header.length = lz_compress(data + pos, header.size, packed);
+        header.raw = header.length >= header.size;
+        if (header.raw) {
+            header.length = header.size;
         }
-        puts("");
+
+        ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             fwrite(header.raw ? data + pos : packed, header.length, 1, fp) == 1;
     }
 
-    return true;
+    free(packed);
+    return ok;
 }
 
-void parse_query_literal(literal *lit, const char *op, table *tables[], int n_tables) {
-    lit->type = op[0] == '"' || isdigit(op[0]) ? literal_type_constant : literal_type_field;
-    if (lit->type == literal_type_field) {
-        for (int i = 0; i < n_tables; i++) {
-            int col = table_find_field(tables[i]->info, op);
-            if (col != -1) {
-                lit->table = tables[i];
-                lit->col = col;
-            }
+bool read_blocks(FILE *fp, uint8_t *data, size_t size) {
+    uint8_t *packed = malloc(CACHE_PAGE_SIZE);
+    bool ok = true;
+
+    for (size_t pos = 0; ok && pos < size; pos += CACHE_PAGE_SIZE) {
+        block_header header;
+        ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+             header.size == (size - pos < CACHE_PAGE_SIZE ? size - pos : CACHE_PAGE_SIZE) &&
+             header.length <= CACHE_PAGE_SIZE;
+        if (!ok) {
+            break;
+        }
+
+        if (header.raw) {
+            ok = fread(data + pos, header.length, 1, fp) == 1;
+        } else {
+            ok = fread(packed, header.length, 1, fp) == 1 &&
+                 lz_decompress(packed, header.length, data + pos, header.size);
         }
+        counters.bytes_read += sizeof(header) + header.length;
     }
 
-    if (lit->type == literal_type_constant && op[0] == '"') {
-        strcpy(lit->value, op + 1);
-        lit->value[strlen(lit->value) - 1] = 0;
-    } else {
-        strcpy(lit->value, op);
+    free(packed);
+    return ok;
+}
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    page frames[CACHE_PAGES];
+    page *buckets[CACHE_BUCKETS];
+    size_t hand;
+} page_cache = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .changed = PTHREAD_COND_INITIALIZER,
+};
+
+// An index is two files; they are swapped in together under this lock so a
+// reader never pairs the header of one build with the rows of another. Hash
+// indexes change in place, under the lock held exclusively.
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static struct {
+    pthread_mutex_t lock;
+    table_handle *handles;
+    int next_id;
+} catalog = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .handles = NULL,
+        .next_id = 1,
+};
+
+page **page_bucket(int handle, size_t number) {
+    return &page_cache.buckets[((size_t) handle * 31 + number) % CACHE_BUCKETS];
+}
+
+void page_unlink(page *p) {
+    page **pp = page_bucket(p->handle, p->number);
+    while (*pp != p) {
+        pp = &(*pp)->next;
     }
+    *pp = p->next;
+    p->handle = 0;
 }
 
-void parse_query_operator(condition_operator *lit, const char *op) {
-    if (strcmp(op, "=") == 0) {
-        *lit = operator_eq;
-    } else {
-        *lit = operator_undefined;
+// Clock sweep over unpinned frames; caller holds the page cache lock.
+page *page_evict(void) {
+    for (size_t i = 0; i < 2 * CACHE_PAGES; i++) {
+        page *p = &page_cache.frames[page_cache.hand];
+        page_cache.hand = (page_cache.hand + 1) % CACHE_PAGES;
+
+        if (p->pins > 0 || p->loading) {
+            continue;
+        }
+        if (p->referenced) {
+            p->referenced = false;
+            continue;
+        }
+        if (p->handle != 0) {
+            page_unlink(p);
+        }
+        return p;
     }
+    return NULL;
 }
 
-bool has_self_join(query q) {
-//    for(int i = 0; i < q.n_conditions; i++) {
-//        if(q.conditions[i].literal1.type == literal_type_field && q.conditions[i].literal2.type == literal_type_field) {
-//
-//        }
-//    }
-    return false;
+// Where the rows of a page start in the data file, after the row count slots.
+// A compressed table's data file only holds the block being filled.
+off_t page_offset(const table_handle *h, size_t number) {
+    return DATA_HEADER_SIZE + (off_t) (h->info.compressed ? 0 : number * h->rows_per_page * h->row_size);
 }
 
-void filter(bool *include, table *t, int col, const char *val) {
-    char field_val[MAX_FIELD_LENGTH];
-    uint8_t data[MAX_FIELD_LENGTH];
-    field_type type = t->info.fields[col].type;
-    for (int i = 0; i < t->info.n_rows; i++) {
-        read_field(data, t, i, col);
-        decode_field(field_val, data, type);
-        *include &= strcmp(field_val, val) == 0;
-        include++;
+// Reads a page from the block file once it has been sealed, otherwise from the
+// data file. Returns the number of bytes read from disk, or -1.
+ssize_t page_read(const table_handle *h, size_t number, uint8_t *data, size_t size) {
+    if (!h->info.compressed || number >= __atomic_load_n(&h->sealed_blocks, __ATOMIC_ACQUIRE)) {
+        ssize_t n = pread(h->fd, data, size, page_offset(h, number));
+        memset(data + (n > 0 ? n : 0), 0, size - (n > 0 ? n : 0));
+        return n;
     }
+
+    block_entry e;
+    if (pread(h->dir_fd, &e, sizeof(e), (off_t) (number * sizeof(e))) != sizeof(e)) {
+        memset(data, 0, size);
+        return -1;
+    }
+
+    uint8_t *packed = e.raw ? data : malloc(e.length);
+    ssize_t n = pread(h->block_fd, packed, e.length, (off_t) e.offset);
+    bool ok = n == e.length && (e.raw ? e.length == size : lz_decompress(packed, e.length, data, size));
+    if (!e.raw) {
+        free(packed);
+    }
+    if (!ok) {
+        memset(data, 0, size);
+        return -1;
+    }
+    return n;
 }
 
-result_set *create_result_set(table *t) {
-    result_set *rs = malloc(sizeof(result_set));
-    rs->table = t;
-    rs->include_rows = malloc(t->info.n_rows * sizeof(bool));
-    for (int i = 0; i < t->info.n_rows * sizeof(bool); ++i) {
-        rs->include_rows[i] = true;
+void page_reserve(const table_handle *h, page *p) {
+    size_t size = h->rows_per_page * h->row_size;
+    if (p->capacity < size) {
+        free(p->data);
+        p->data = malloc(size);
+        p->capacity = size;
     }
-    return rs;
 }
 
-result_set *get_result_set(result_set **rs, int rs_size, table *t) {
-    for (int i = 0; i < rs_size; i++) {
-        if (rs[i]->table == t) {
-            return rs[i];
+// Completes the load of a frame marked loading, reading it from disk when its
+// data is missing or a row written while we were reading has marked it stale.
+void page_finish_load(const table_handle *h, page *p, bool read) {
+    size_t size = h->rows_per_page * h->row_size;
+
+    pthread_mutex_lock(&page_cache.lock);
+    while (read || p->stale) {
+        p->stale = false;
+        pthread_mutex_unlock(&page_cache.lock);
+
+        ssize_t n = page_read(h, p->number, p->data, size);
+        counters.page_reads++;
+        counters.bytes_read += n > 0 ? n : 0;
+        read = false;
+
+        pthread_mutex_lock(&page_cache.lock);
+    }
+    p->loading = false;
+    pthread_cond_broadcast(&page_cache.changed);
+    pthread_mutex_unlock(&page_cache.lock);
+}
+
+page *page_pin(const table_handle *h, size_t number) {
+    pthread_mutex_lock(&page_cache.lock);
+
+    page *p;
+    for (;;) {
+        for (p = *page_bucket(h->id, number); p != NULL; p = p->next) {
+            if (p->handle == h->id && p->number == number) {
+                break;
+            }
+        }
+
+        if (p != NULL) {
+            if (p->loading) {
+                pthread_cond_wait(&page_cache.changed, &page_cache.lock);
+                continue;
+            }
+            p->pins++;
+            p->referenced = true;
+            pthread_mutex_unlock(&page_cache.lock);
+            counters.page_hits++;
+            return p;
+        }
+
+        p = page_evict();
+        if (p != NULL) {
+            break;
         }
+        pthread_cond_wait(&page_cache.changed, &page_cache.lock);
     }
-    fputs("Result set not found", stderr);
-    return NULL;
+
+    page **bucket = page_bucket(h->id, number);
+    p->handle = h->id;
+    p->number = number;
+    p->pins = 1;
+    p->loading = true;
+    p->stale = false;
+    p->referenced = true;
+    p->next = *bucket;
+    *bucket = p;
+    pthread_mutex_unlock(&page_cache.lock);
+
+    page_reserve(h, p);
+    page_finish_load(h, p, true);
+    return p;
 }
 
-size_t count_included_rows(size_t n, const bool *array) {
-    size_t x = 0;
-    for (size_t i = 0; i < n; ++i) {
-        if (array[i]) {
-            x++;
+void page_unpin(page *p) {
+    pthread_mutex_lock(&page_cache.lock);
+    p->pins--;
+    if (p->pins == 0) {
+        pthread_cond_broadcast(&page_cache.changed);
+    }
+    pthread_mutex_unlock(&page_cache.lock);
+}
+
+// Write-through for a row that has just been written to the data file.
+void page_write_row(const table_handle *h, size_t row, const uint8_t *data) {
+    size_t number = row / h->rows_per_page;
+
+    pthread_mutex_lock(&page_cache.lock);
+    for (page *p = *page_bucket(h->id, number); p != NULL; p = p->next) {
+        if (p->handle == h->id && p->number == number) {
+            if (p->loading) {
+                p->stale = true;
+            } else {
+                memcpy(p->data + (row % h->rows_per_page) * h->row_size, data, h->row_size);
+            }
+            break;
         }
     }
+    pthread_mutex_unlock(&page_cache.lock);
+}
 
-    return x;
+// A page that has just moved to the block file; a load that may have read
+// the data file while it was being reused is repeated.
+void page_invalidate(const table_handle *h, size_t number) {
+    pthread_mutex_lock(&page_cache.lock);
+    for (page *p = *page_bucket(h->id, number); p != NULL; p = p->next) {
+        if (p->handle == h->id && p->number == number) {
+            p->stale = p->loading;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&page_cache.lock);
 }
 
-table *table_to_temp_table(table *t, const bool *include_rows) {
-    table *tmp = create_temp_table(t->info.n_fields, t->info.fields,
-                                   count_included_rows(t->info.n_rows, include_rows));
-    size_t index = 0;
-    for (size_t i = 0; i < t->info.n_rows; i++) {
-        if (include_rows[i]) {
-            size_t offset = mem_offset(t->info.n_fields, t->info.fields, index++, 0);
-            size_t seek = seek_pos(t->info, i, 0);
-            size_t row_sz = row_size(t->info) * sizeof(uint8_t);
-            fseek(t->fp, seek, SEEK_SET);
-            fread(tmp->data + offset, row_sz, 1, t->fp);
+void page_cache_drop(int handle) {
+    pthread_mutex_lock(&page_cache.lock);
+    for (int i = 0; i < CACHE_PAGES; i++) {
+        if (page_cache.frames[i].handle == handle) {
+            page_unlink(&page_cache.frames[i]);
         }
     }
-    tmp->info.n_rows = index;
-    return tmp;
+    pthread_mutex_unlock(&page_cache.lock);
 }
 
-table *temp_table_inner_join(table *table_a, int col_a,
-                             table *table_b, int col_b) {
-    char val1[MAX_FIELD_LENGTH];
-    char val2[MAX_FIELD_LENGTH];
+// Hashes the key of a hash index entry, a char value up to its NUL.
+uint64_t hash_key(const field *f, const uint8_t *raw) {
+    size_t n = f->type == field_type_char ? strnlen((const char *) raw, field_size(*f)) : field_size(*f);
+    uint64_t hash = hash_bytes(raw, n);
+    // the low bits pick the bucket; FNV leaves them poorly mixed
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdu;
+    return hash ^ hash >> 33;
+}
 
-    int n_fields = table_a->info.n_fields + table_b->info.n_fields;
-    field fields[n_fields];
+uint64_t hash_bucket(const hash_header *header, uint64_t hash) {
+    uint64_t bucket = hash & ((UINT64_C(1) << header->level) - 1);
+    if (bucket < header->split) {
+        bucket = hash & ((UINT64_C(2) << header->level) - 1);
+    }
+    return bucket;
+}
 
-    memcpy(fields, table_a->info.fields, table_a->info.n_fields * sizeof(field));
-    memcpy(fields + table_a->info.n_fields, table_b->info.fields, table_b->info.n_fields * sizeof(field));
+off_t hash_bucket_offset(const hash_index *ix, uint64_t bucket) {
+    return (off_t) ((bucket + 1) * ix->header.page_size);
+}
 
-//#ifdef DEBUG
-//    for (int i = 0; i < n_fields; i++) {
-//        printf("%s\t%s(%lu)\n", fields[i].name, field_type_to_str(fields[i].type),
-//               fields[i].length);
-//    }
-//    printf("-----PARSED FIELDS-----\n");
-//#endif
+off_t hash_overflow_offset(const hash_index *ix, uint32_t number) {
+    return (off_t) ((number - 1) * ix->header.page_size);
+}
 
-    table *tmp = create_temp_table(n_fields, fields, table_a->info.n_rows * table_b->info.n_rows);
-    tmp->info.n_rows = 0;
+void hash_index_layout(hash_index *ix) {
+    ix->entry_size = row_size(ix->header.info) + sizeof(uint64_t);
+    ix->page_entries = (ix->header.page_size - sizeof(hash_page)) / ix->entry_size;
+}
 
-    for (size_t i = 0; i < table_a->info.n_rows; i++) {
-        decode_temp_table_field(val1, table_a, i, col_a);
-        size_t table_a_offset = row_size(table_a->info) * i;
-        for (size_t j = 0; j < table_b->info.n_rows; j++) {
-            decode_temp_table_field(val2, table_b, j, col_b);
-            size_t table_b_offset = row_size(table_b->info) * j;
-            if (strcmp(val1, val2) == 0) {
-#ifdef DEBUG
-                printf("MATCH %s %s\n", val1, val2);
-#endif
-                size_t offset = mem_offset(n_fields, fields, tmp->info.n_rows, 0);
-                memcpy(tmp->data + offset, table_a->data + table_a_offset, row_size(table_a->info));
-                memcpy(tmp->data + offset + row_size(table_a->info), table_b->data + table_b_offset,
-                       row_size(table_b->info));
-                tmp->info.n_rows++;
-            }
-        }
+void close_hash_index(hash_index *ix) {
+    if (ix->fd != -1) {
+        close(ix->fd);
     }
+    if (ix->overflow_fd != -1) {
+        close(ix->overflow_fd);
+    }
+    free(ix);
+}
 
-    return tmp;
+// Names the file of prefix with suffix; false if the name does not fit.
+bool hash_file_name(char *fname, size_t size, const char *prefix, const char *suffix) {
+    int n = snprintf(fname, size, "%s%s", prefix, suffix);
+    return n >= 0 && (size_t) n < size;
 }
 
-#ifdef DEBUG
+// Opens the files of a hash index named after prefix.
+hash_index *open_hash_index(const char *prefix, int flags) {
+    hash_index *ix = calloc(1, sizeof(hash_index));
+    char fname[FILENAME_MAX];
+    ix->fd = hash_file_name(fname, sizeof(fname), prefix, ".hash") ? open(fname, flags, 0644) : -1;
+    ix->overflow_fd = ix->fd != -1 && hash_file_name(fname, sizeof(fname), prefix, ".hash.ovf")
+                      ? open(fname, flags, 0644) : -1;
+
+    bool ok = ix->overflow_fd != -1;
+    if (ok && (flags & O_TRUNC) == 0) {
+        ok = pread(ix->fd, &ix->header, sizeof(hash_header), 0) == sizeof(hash_header) &&
+             memcmp(ix->header.magic, HASH_MAGIC, sizeof(ix->header.magic)) == 0;
+        hash_index_layout(ix);
+    }
+    if (!ok) {
+        close_hash_index(ix);
+        return NULL;
+    }
+    return ix;
+}
 
-void print_table(table *t) {
-    char text[MAX_FIELD_LENGTH];
-    for (int i = 0; i < t->info.n_rows; i++) {
-        for (int j = 0; j < t->info.n_fields; j++) {
-            decode_temp_table_field(text, t, i, j);
-            printf("%12s ", text);
+bool write_hash_header(const hash_index *ix) {
+    hash_header header = ix->header;
+    return pwrite(ix->fd, &header, sizeof(header), 0) == sizeof(header);
+}
+
+// Takes a page off the free list of the overflow file, or a new one at its
+// end; 0 if the free list cannot be read.
+uint32_t allocate_hash_overflow(hash_index *ix) {
+    hash_header *header = &ix->header;
+    if (header->free_overflow == 0) {
+        return (uint32_t) ++header->n_overflow;
+    }
+
+    uint32_t number = (uint32_t) header->free_overflow;
+    hash_page p;
+    if (pread(ix->overflow_fd, &p, sizeof(p), hash_overflow_offset(ix, number)) != sizeof(p)) {
+        return 0;
+    }
+    header->free_overflow = p.overflow;
+    return number;
+}
+
+// Writes entries as the chain of a bucket, taking overflow pages as needed.
+bool write_hash_chain(hash_index *ix, uint64_t bucket, const uint8_t *entries, size_t n) {
+    size_t page_size = ix->header.page_size;
+    uint8_t *page = malloc(page_size);
+    int fd = ix->fd;
+    off_t pos = hash_bucket_offset(ix, bucket);
+    size_t done = 0;
+    bool ok = true;
+
+    do {
+        hash_page p = {0, 0};
+        p.count = (uint32_t) (n - done < ix->page_entries ? n - done : ix->page_entries);
+        if (done + p.count < n) {
+            p.overflow = allocate_hash_overflow(ix);
+            ok = p.overflow != 0;
         }
-        printf("\n");
+        memset(page, 0, page_size);
+        memcpy(page, &p, sizeof(p));
+        memcpy(page + sizeof(p), entries + done * ix->entry_size, p.count * ix->entry_size);
+        ok = ok && pwrite(fd, page, page_size, pos) == (ssize_t) page_size;
+
+        done += p.count;
+        fd = ix->overflow_fd;
+        pos = hash_overflow_offset(ix, p.overflow);
+    } while (ok && done < n);
+
+    free(page);
+    return ok;
+}
+
+// Creates an empty hash index over some columns of a table, in files named
+// after prefix.
+hash_index *create_hash_index(const char *prefix, const char *name, const table_info *info, const int *cols,
+                              int n_cols) {
+    hash_index *ix = open_hash_index(prefix, O_RDWR | O_CREAT | O_TRUNC);
+    if (ix == NULL) {
+        return NULL;
+    }
+
+    snprintf(ix->name, sizeof(ix->name), "%s", name);
+    hash_header *header = &ix->header;
+    memcpy(header->magic, HASH_MAGIC, sizeof(header->magic));
+    snprintf(header->info.name, sizeof(header->info.name), "%s", info->name);
+    header->info.n_fields = n_cols;
+    for (int j = 0; j < n_cols; j++) {
+        ix->cols[j] = cols[j];
+        header->info.fields[j] = info->fields[cols[j]];
+        // entries hold the values themselves
+        header->info.fields[j].dictionary = false;
+    }
+    ix->n_cols = n_cols;
+
+    header->page_size = HASH_PAGE_SIZE;
+    hash_index_layout(ix);
+    while (ix->page_entries < HASH_MIN_PAGE_ENTRIES) {
+        header->page_size *= 2;
+        hash_index_layout(ix);
+    }
+
+    uint8_t *page = calloc(header->page_size, 1);
+    bool ok = pwrite(ix->fd, page, header->page_size, 0) == (ssize_t) header->page_size &&
+              write_hash_header(ix) && write_hash_chain(ix, 0, NULL, 0);
+    free(page);
+    if (!ok) {
+        close_hash_index(ix);
+        return NULL;
     }
+    return ix;
 }
-#endif
 
-bool do_join_query(query q) {
-    int rs_size = 1;
+// Fills the entry of a table row for a hash index, decoding dictionary
+// columns with dicts.
+void hash_entry(const hash_index *ix, const table_info *info, dictionary *const *dicts, const uint8_t *row,
+                uint64_t id, uint8_t *entry) {
+    for (int j = 0; j < ix->n_cols; j++) {
+        const field *f = &info->fields[ix->cols[j]];
+        const uint8_t *raw = row + seek_pos(*info, 0, ix->cols[j]);
+        uint8_t *value = entry + seek_pos(ix->header.info, 0, j);
+        if (f->dictionary) {
+            memset(value, 0, field_size(ix->header.info.fields[j]));
+            strcpy((char *) value, dictionary_value(dicts[ix->cols[j]], field_code(raw)));
+        } else {
+            memcpy(value, raw, field_size(*f));
+        }
+    }
+    memcpy(entry + ix->entry_size - sizeof(id), &id, sizeof(id));
+}
 
-    // we ignore outer joins
+// Splits the bucket at the split pointer: its entries are shared between it
+// and a new bucket at the end by one more bit of their hash.
+bool split_hash_bucket(hash_index *ix) {
+    hash_header *header = &ix->header;
+    uint64_t bucket = header->split;
+    uint64_t image = bucket + (UINT64_C(1) << header->level);
+    size_t page_size = header->page_size;
+
+    // read the chain, putting its overflow pages on the free list
+    uint8_t *page = malloc(page_size);
+    uint8_t *entries = NULL;
+    size_t n = 0;
+    int fd = ix->fd;
+    off_t pos = hash_bucket_offset(ix, bucket);
+    bool ok;
+    for (;;) {
+        hash_page p;
+        ok = pread(fd, page, page_size, pos) == (ssize_t) page_size;
+        if (!ok) {
+            break;
+        }
+        memcpy(&p, page, sizeof(p));
+        entries = realloc(entries, (n + p.count) * ix->entry_size + 1);
+        memcpy(entries + n * ix->entry_size, page + sizeof(p), p.count * ix->entry_size);
+        n += p.count;
+
+        if (fd == ix->overflow_fd) {
+            hash_page free_page = {0, (uint32_t) header->free_overflow};
+            ok = pwrite(fd, &free_page, sizeof(free_page), pos) == sizeof(free_page);
+            header->free_overflow = (uint64_t) (pos / (off_t) page_size) + 1;
+        }
+        if (!ok || p.overflow == 0) {
+            break;
+        }
+        fd = ix->overflow_fd;
+        pos = hash_overflow_offset(ix, p.overflow);
+    }
+    free(page);
 
-    result_set **rs_c = alloca(sizeof(result_set *) * q.n_tables);
-    for (int i = 0; i < q.n_tables; i++) {
-        rs_size *= q.tables[i]->info.n_rows;
-        rs_c[i] = create_result_set(q.tables[i]);
+    if (++header->split == UINT64_C(1) << header->level) {
+        header->level++;
+        header->split = 0;
     }
 
-    // run all filters
-    int filter_cond_count = 0;
-    for (int i = 0; i < q.n_conditions; i++) {
-        if (q.conditions[i].literal2.type != literal_type_constant) {
-            continue;
+    // entries that stay are packed at the front, those that move at the back
+    uint8_t *swap = malloc(ix->entry_size);
+    size_t stay = 0;
+    size_t end = n;
+    while (stay < end) {
+        uint8_t *entry = entries + stay * ix->entry_size;
+        if (hash_bucket(header, hash_key(&header->info.fields[0], entry)) == bucket) {
+            stay++;
+        } else {
+            end--;
+            memcpy(swap, entry, ix->entry_size);
+            memcpy(entry, entries + end * ix->entry_size, ix->entry_size);
+            memcpy(entries + end * ix->entry_size, swap, ix->entry_size);
         }
-        filter_cond_count++;
-        result_set *rs = get_result_set(rs_c, rs_size, q.conditions[i].literal1.table);
-        filter(rs->include_rows, q.conditions[i].literal1.table, q.conditions[i].literal1.col,
-               q.conditions[i].literal2.value);
     }
+    free(swap);
 
-//    join_result_set **jrs_c = alloca(sizeof(join_result_set *) * q.n_conditions - filter_cond_count);
-    table *result = NULL;
-    int index = 0;
-    for (int i = 0; i < q.n_conditions; i++) {
-        if (!q.conditions[i].literal2.type != literal_type_constant) {
-            continue;
+    ok = ok && write_hash_chain(ix, image, entries + stay * ix->entry_size, n - stay) &&
+         write_hash_chain(ix, bucket, entries, stay);
+    free(entries);
+    return ok;
+}
+
+// Adds an entry to the end of its bucket's chain, and splits a bucket once
+// the buckets are three quarters full on average. An entry for the same row
+// id in the chain, left by an insert that died before committing the row, is
+// overwritten instead. Called with index_lock held exclusively while readers
+// can see the index.
+bool hash_insert(hash_index *ix, const uint8_t *entry) {
+    hash_header *header = &ix->header;
+    uint64_t bucket = hash_bucket(header, hash_key(&header->info.fields[0], entry));
+    size_t page_size = header->page_size;
+    size_t id_pos = ix->entry_size - sizeof(uint64_t);
+    uint8_t *page = malloc(page_size);
+    int fd = ix->fd;
+    off_t pos = hash_bucket_offset(ix, bucket);
+    hash_page p;
+
+    for (;;) {
+        if (pread(fd, page, page_size, pos) != (ssize_t) page_size) {
+            free(page);
+            return false;
         }
+        memcpy(&p, page, sizeof(p));
+        for (uint32_t i = 0; i < p.count && i < ix->page_entries; i++) {
+            off_t at = (off_t) (sizeof(p) + i * ix->entry_size);
+            if (memcmp(page + at + id_pos, entry + id_pos, sizeof(uint64_t)) == 0) {
+                free(page);
+                return pwrite(fd, entry, ix->entry_size, pos + at) == (ssize_t) ix->entry_size;
+            }
+        }
+        if (p.overflow == 0) {
+            break;
+        }
+        fd = ix->overflow_fd;
+        pos = hash_overflow_offset(ix, p.overflow);
+    }
+    free(page);
+
+    bool ok;
+    if (p.count < ix->page_entries) {
+        ok = pwrite(fd, entry, ix->entry_size, pos + (off_t) (sizeof(p) + p.count * ix->entry_size)) ==
+             (ssize_t) ix->entry_size;
+        p.count++;
+        ok = ok && pwrite(fd, &p, sizeof(p), pos) == sizeof(p);
+    } else {
+        // the new page is written before the chain links to it
+        p.overflow = allocate_hash_overflow(ix);
+        page = calloc(page_size, 1);
+        hash_page last = {1, 0};
+        memcpy(page, &last, sizeof(last));
+        memcpy(page + sizeof(last), entry, ix->entry_size);
+        ok = p.overflow != 0 &&
+             pwrite(ix->overflow_fd, page, page_size, hash_overflow_offset(ix, p.overflow)) == (ssize_t) page_size &&
+             pwrite(fd, &p, sizeof(p), pos) == sizeof(p);
+        free(page);
+    }
 
-        if (index == 0) {
-            result_set *rs = get_result_set(rs_c, rs_size, q.conditions->literal1.table);
-            result = table_to_temp_table(q.conditions[i].literal1.table, rs->include_rows);
-#ifdef DEBUG
-            print_table(result);
-#endif
+    header->n_entries++;
+    uint64_t n_buckets = (UINT64_C(1) << header->level) + header->split;
+    if (ok && header->n_entries * 4 > n_buckets * ix->page_entries * 3) {
+        ok = split_hash_bucket(ix);
+    }
+    return ok && write_hash_header(ix);
+}
+
+// Opens the hash indexes of a table, which inserts keep up to date.
+void load_hash_indexes(table_handle *h) {
+    char names[MAX_TABLE_INDEXES][MAX_TABLE_NAME_SIZE];
+    int n = read_table_indexes(h->info.name, names, MAX_TABLE_INDEXES);
+    for (int i = 0; i < n; i++) {
+        // sorted indexes have no hash files
+        hash_index *ix = open_hash_index(names[i], O_RDWR);
+        if (ix == NULL) {
+            continue;
+        }
+        memcpy(ix->name, names[i], sizeof(ix->name));
+        bool found = strcmp(ix->header.info.name, h->info.name) == 0;
+        for (int j = 0; found && j < ix->header.info.n_fields; j++) {
+            ix->cols[j] = table_find_field(h->info, ix->header.info.fields[j].name);
+            found = ix->cols[j] != -1;
+        }
+        if (!found) {
+            close_hash_index(ix);
+            continue;
         }
+        ix->n_cols = ix->header.info.n_fields;
+        ix->next = h->hash_indexes;
+        h->hash_indexes = ix;
+    }
+}
 
-        table *tmp = table_to_temp_table(q.conditions[i].literal2.table,
-                                         get_result_set(rs_c, rs_size,
-                                                        q.conditions->literal2.table)->include_rows);
+bool rename_hash_index(const char *from, const char *to) {
+    static const char *suffixes[] = {".hash.ovf", ".hash"};
+    char old_name[FILENAME_MAX];
+    char new_name[FILENAME_MAX];
+    bool ok = true;
+    for (int i = 0; ok && i < 2; i++) {
+        ok = hash_file_name(old_name, sizeof(old_name), from, suffixes[i]) &&
+             hash_file_name(new_name, sizeof(new_name), to, suffixes[i]) && rename(old_name, new_name) == 0;
+    }
+    return ok;
+}
 
-        result = temp_table_inner_join(result, table_find_field(result->info, q.conditions[i].literal1.value), tmp,
-                                       q.conditions[i].literal2.col);
-        index++;
+void remove_hash_index(const char *prefix) {
+    char fname[FILENAME_MAX];
+    if (hash_file_name(fname, sizeof(fname), prefix, ".hash")) {
+        unlink(fname);
+    }
+    if (hash_file_name(fname, sizeof(fname), prefix, ".hash.ovf")) {
+        unlink(fname);
     }
+}
 
-#ifdef DEBUG
-    printf("Rows: %lu\n", result->info.n_rows);
-//    for (int i = 0; i < result->n_fields; i++) {
-//        printf("%s\t%s(%lu)\n", result->fields[i].name, field_type_to_str(result->fields[i].type),
-//               result->fields[i].length);
-//    }
-    puts("-------");
-#endif
+// Closes the files and frees the state that load_table_handle has set up.
+void close_table_files(table_handle *h) {
+    int fds[] = {h->fd, h->block_fd, h->dir_fd, h->dict_fd, h->zone_fd, h->del_fd};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+        }
+    }
+    for (int i = 0; i < h->info.n_fields; i++) {
+        free_dictionary(h->dicts[i]);
+    }
+    free(h->zones);
+    free(h->deleted);
+}
 
-    int field_names[q.n_fields];
-    for (int k = 0; k < q.n_fields; k++) {
-        field_names[k] = table_find_field(result->info, q.fields[k].field);
+void free_table_handle(table_handle *h) {
+    close_table_files(h);
+    while (h->hash_indexes != NULL) {
+        hash_index *ix = h->hash_indexes;
+        h->hash_indexes = ix->next;
+        close_hash_index(ix);
     }
+    page_cache_drop(h->id);
+    pthread_rwlock_destroy(&h->schema_lock);
+    pthread_mutex_destroy(&h->append_lock);
+    pthread_mutex_destroy(&h->zone_lock);
+    pthread_mutex_destroy(&h->delete_lock);
+    free(h);
+}
 
-    char value[MAX_FIELD_LENGTH];
-    for (size_t i = 0; i < result->info.n_rows; i++) {
-        for (int j = 0; j < q.n_fields; j++) {
-            decode_temp_table_field(value, result, i, field_names[j]);
-            printf("%s%s", j == 0 ? "" : ",", value);
+// Dictionary values are kept in <table>.dict as records of a uint32_t column
+// followed by the NUL-padded value, in code order.
+bool load_dictionaries(table_handle *h, const char *name) {
+    bool any = false;
+    for (int i = 0; i < h->info.n_fields; i++) {
+        h->dicts[i] = h->info.fields[i].dictionary ? create_dictionary(h->info.fields[i].length + 1) : NULL;
+        any |= h->dicts[i] != NULL;
+    }
+    if (!any) {
+        return true;
+    }
+
+    char fname[FILENAME_MAX];
+    sprintf(fname, "%s.dict", name);
+    h->dict_fd = open(fname, O_RDWR | O_CREAT, 0644);
+    if (h->dict_fd == -1) {
+        perror("Error opening dictionary");
+        return false;
+    }
+
+    char value[MAX_FIELD_LENGTH + 1];
+    for (;;) {
+        uint32_t col;
+        if (pread(h->dict_fd, &col, sizeof(col), h->dict_end) != sizeof(col) || col >= (uint32_t) h->info.n_fields ||
+            h->dicts[col] == NULL) {
+            break;
         }
-        printf("\n");
+        size_t width = h->dicts[col]->width;
+        if (pread(h->dict_fd, value, width, h->dict_end + sizeof(col)) != (ssize_t) width) {
+            break;
+        }
+        // a record cut short by an interrupted insert is overwritten by the next one
+        value[width - 1] = 0;
+        if (dictionary_add(h->dicts[col], value) == -1) {
+            break;
+        }
+        h->dict_end += (off_t) (sizeof(col) + width);
+    }
+    return true;
+}
+
+// Zones are kept in <table>.zone, one record per block: a uint64_t that is 1
+// once the zones cover every row of the block, then a zone per field.
+bool load_zones(table_handle *h, const char *name) {
+    char fname[FILENAME_MAX];
+    sprintf(fname, "%s.zone", name);
+    h->zone_fd = open(fname, O_RDWR | O_CREAT, 0644);
+    if (h->zone_fd == -1) {
+        perror("Error opening zones");
+        return false;
+    }
+
+    off_t size = lseek(h->zone_fd, 0, SEEK_END);
+    h->n_zone_blocks = size > 0 ? (size_t) size / h->zone_size : 0;
+    h->zone_capacity = h->n_zone_blocks;
+    h->zones = malloc(h->zone_capacity * h->zone_size + 1);
+    ssize_t n = (ssize_t) (h->n_zone_blocks * h->zone_size);
+    return pread(h->zone_fd, h->zones, n, 0) == n;
+}
+
+// Bit i of <table>.del is set once row i has been deleted.
+bool load_tombstones(table_handle *h, const char *name) {
+    char fname[FILENAME_MAX];
+    sprintf(fname, "%s.del", name);
+    h->del_fd = open(fname, O_RDWR | O_CREAT, 0644);
+    if (h->del_fd == -1) {
+        perror("Error opening tombstones");
+        return false;
+    }
+
+    off_t size = lseek(h->del_fd, 0, SEEK_END);
+    h->deleted_size = size > 0 ? (size_t) size : 0;
+    h->deleted = calloc(h->deleted_size + 1, 1);
+    if (pread(h->del_fd, h->deleted, h->deleted_size, 0) != (ssize_t) h->deleted_size) {
+        return false;
+    }
+    for (size_t i = 0; i < h->deleted_size; i++) {
+        h->n_deleted += __builtin_popcount(h->deleted[i]);
     }
+    return true;
+}
+
+// The row count lives at the start of the data file, in two slots written in
+// turn: a torn write can only damage the slot being written, and the other
+// still holds the previous count.
+typedef struct {
+    uint64_t n_rows;
+    uint64_t check;
+} row_count_slot;
+
+uint64_t row_count_check(uint64_t n_rows) {
+    return hash_bytes(&n_rows, sizeof(n_rows)) ^ 0x726f7773;
+}
+
+size_t read_row_count(const table_handle *h) {
+    row_count_slot slots[2];
+    if (pread(h->fd, slots, sizeof(slots), 0) != sizeof(slots)) {
+        return 0;
+    }
+
+    size_t n_rows = 0;
+    for (int i = 0; i < 2; i++) {
+        if (slots[i].check == row_count_check(slots[i].n_rows) && slots[i].n_rows > n_rows) {
+            n_rows = slots[i].n_rows;
+        }
+    }
+
+    // a plain data file must also hold the rows it counts
+    off_t size = lseek(h->fd, 0, SEEK_END);
+    size_t stored = size > DATA_HEADER_SIZE ? (size_t) (size - DATA_HEADER_SIZE) / h->row_size : 0;
+    if (!h->info.compressed && n_rows > stored) {
+        n_rows = stored;
+    }
+    return n_rows;
+}
+
+// Commits n_rows, after the rows themselves have been written. Called with
+// the append lock held.
+bool write_row_count(const table_handle *h, size_t n_rows) {
+    row_count_slot slot = {n_rows, row_count_check(n_rows)};
+    off_t pos = (off_t) ((n_rows % 2) * sizeof(slot));
+    return pwrite(h->fd, &slot, sizeof(slot), pos) == sizeof(slot);
+}
+
+// Opens the files of a table that are named after prefix, which is the table
+// name except while VACUUM writes the compacted copy.
+table_handle *open_table_handle(const table_info *info, const char *prefix) {
+    table_handle *h = calloc(1, sizeof(table_handle));
+    h->info = *info;
+
+    h->block_fd = -1;
+    h->dir_fd = -1;
+    h->dict_fd = -1;
+    h->zone_fd = -1;
+    h->del_fd = -1;
+
+    char fname[FILENAME_MAX];
+    sprintf(fname, "%s.bin", prefix);
+
+    h->fd = open(fname, O_RDWR | O_CREAT, 0644);
+
+    if (h->fd == -1) {
+        perror("Error opening table");
+        free(h);
+        return NULL;
+    }
+
+    h->row_size = row_size(h->info);
+    h->rows_per_page = h->row_size < CACHE_PAGE_SIZE ? CACHE_PAGE_SIZE / h->row_size : 1;
+    h->zone_size = sizeof(uint64_t) + h->info.n_fields * sizeof(zone);
+    h->codec = find_schema_codec(&h->info);
+    h->info.n_rows = read_row_count(h);
+
+    if (!load_dictionaries(h, prefix) || !load_zones(h, prefix) || !load_tombstones(h, prefix)) {
+        close_table_files(h);
+        free(h);
+        return NULL;
+    }
+
+    if (h->info.compressed) {
+        sprintf(fname, "%s.zblk", prefix);
+        h->block_fd = open(fname, O_RDWR | O_CREAT, 0644);
+        sprintf(fname, "%s.zdir", prefix);
+        h->dir_fd = open(fname, O_RDWR | O_CREAT, 0644);
+
+        if (h->block_fd == -1 || h->dir_fd == -1) {
+            perror("Error opening table blocks");
+            close_table_files(h);
+            free(h);
+            return NULL;
+        }
+
+        // entries past the committed rows were left by an interrupted insert
+        off_t dir_size = lseek(h->dir_fd, 0, SEEK_END);
+        size_t full_blocks = h->info.n_rows / h->rows_per_page;
+        h->sealed_blocks = dir_size > 0 ? (size_t) dir_size / sizeof(block_entry) : 0;
+        if (h->sealed_blocks > full_blocks) {
+            h->sealed_blocks = full_blocks;
+        }
+
+        block_entry e;
+        if (h->sealed_blocks > 0 &&
+            pread(h->dir_fd, &e, sizeof(e), (off_t) ((h->sealed_blocks - 1) * sizeof(e))) == sizeof(e)) {
+            h->block_end = (off_t) (e.offset + e.length);
+        }
+    }
+
+    h->committed_rows = h->info.n_rows;
+    h->dropped = false;
+    h->refs = 1;
+    h->next = NULL;
+    pthread_rwlock_init(&h->schema_lock, NULL);
+    pthread_mutex_init(&h->append_lock, NULL);
+    pthread_mutex_init(&h->zone_lock, NULL);
+    pthread_mutex_init(&h->delete_lock, NULL);
+    return h;
+}
+
+// The files VACUUM rewrites, renamed over the table's in this order.
+static const char *vacuum_files[] = {"zone", "dict", "zdir", "zblk", "bin", "del"};
+
+void remove_table_files(const char *prefix) {
+    char fname[FILENAME_MAX];
+    for (size_t i = 0; i < sizeof(vacuum_files) / sizeof(vacuum_files[0]); i++) {
+        sprintf(fname, "%s.%s", prefix, vacuum_files[i]);
+        unlink(fname);
+    }
+}
+
+// VACUUM writes the compacted table under <table>.vacuum and its hash
+// indexes under <index>.vacuum, and commits by creating <table>.vacuum.commit
+// before renaming them over the old files. Finishes the renames of a
+// committed VACUUM, which a crash may have cut short, or drops the files of
+// one that did not commit. Called with catalog.lock held, before the table is
+// opened.
+bool finish_vacuum(const char *table_name) {
+    char prefix[MAX_TABLE_NAME_SIZE + 8];
+    char marker[FILENAME_MAX];
+    sprintf(prefix, "%s.vacuum", table_name);
+    sprintf(marker, "%s.commit", prefix);
+    bool committed = access(marker, F_OK) == 0;
+
+    char names[MAX_TABLE_INDEXES][MAX_TABLE_NAME_SIZE];
+    int n = read_table_indexes(table_name, names, MAX_TABLE_INDEXES);
+    bool ok = true;
+    char from[FILENAME_MAX];
+    char to[FILENAME_MAX];
+
+    pthread_rwlock_wrlock(&index_lock);
+    for (size_t i = 0; committed && ok && i < sizeof(vacuum_files) / sizeof(vacuum_files[0]); i++) {
+        sprintf(from, "%s.%s", prefix, vacuum_files[i]);
+        sprintf(to, "%s.%s", table_name, vacuum_files[i]);
+        ok = rename(from, to) == 0 || errno == ENOENT;
+    }
+    for (int k = 0; ok && k < n; k++) {
+        static const char *suffixes[] = {".hash.ovf", ".hash"};
+        for (int i = 0; ok && i < 2; i++) {
+            sprintf(from, "%s.vacuum%s", names[k], suffixes[i]);
+            sprintf(to, "%s%s", names[k], suffixes[i]);
+            ok = committed ? rename(from, to) == 0 || errno == ENOENT : unlink(from) == 0 || errno == ENOENT;
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+
+    if (!committed) {
+        remove_table_files(prefix);
+    } else if (ok) {
+        unlink(marker);
+    }
+    return ok;
+}
+
+table_handle *load_table_handle(const char *name) {
+    table_info info;
+    if (!read_table_info(&info, name) || !finish_vacuum(name)) {
+        return NULL;
+    }
+    table_handle *h = open_table_handle(&info, name);
+    if (h != NULL) {
+        load_hash_indexes(h);
+    }
+    return h;
+}
+
+// Returns the shared handle for a table, loading it into the catalog on first use.
+table_handle *catalog_acquire(const char *name) {
+    pthread_mutex_lock(&catalog.lock);
+
+    table_handle *h = catalog.handles;
+    while (h != NULL && strcmp(h->info.name, name) != 0) {
+        h = h->next;
+    }
+
+    if (h == NULL && (h = load_table_handle(name)) != NULL) {
+        h->id = catalog.next_id++;
+        h->next = catalog.handles;
+        catalog.handles = h;
+    }
+
+    if (h != NULL) {
+        h->refs++;
+    }
+
+    pthread_mutex_unlock(&catalog.lock);
+    return h;
+}
+
+void catalog_release(table_handle *h) {
+    pthread_mutex_lock(&catalog.lock);
+    bool last = --h->refs == 0;
+    pthread_mutex_unlock(&catalog.lock);
+
+    if (last) {
+        free_table_handle(h);
+    }
+}
+
+// A page being read in the background. It holds a reference to the handle so
+// the files stay open until the read completes.
+typedef struct read_request {
+    table_handle *h;
+    page *p;
+    int fd;
+    off_t pos;
+    uint8_t *buffer;
+    size_t length;
+    bool sealed;
+    block_entry entry;
+    uint8_t *packed;
+    struct read_request *next;
+} read_request;
+
+// Read-ahead goes through an io_uring when the kernel offers one, and through
+// a few threads doing plain preads otherwise.
+static struct {
+    pthread_once_t once;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    read_ahead_mode mode;
+    size_t in_flight;
+    size_t peak_in_flight;
+    read_request *head;
+    read_request *tail;
+    int ring_fd;
+    unsigned entries;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+} read_ahead = {
+        .once = PTHREAD_ONCE_INIT,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .queued = PTHREAD_COND_INITIALIZER,
+        .mode = read_ahead_uring,
+        .ring_fd = -1,
+};
+
+void catalog_retain(table_handle *h) {
+    pthread_mutex_lock(&catalog.lock);
+    h->refs++;
+    pthread_mutex_unlock(&catalog.lock);
+}
+
+void read_request_done(read_request *r, bool ok) {
+    page_finish_load(r->h, r->p, !ok);
+    catalog_release(r->h);
+    free(r->packed);
+    free(r);
+}
+
+// Checks what the read returned, and decompresses it.
+void read_request_complete(read_request *r, int res) {
+    size_t size = r->h->rows_per_page * r->h->row_size;
+    bool ok;
+
+    if (!r->sealed) {
+        ok = res >= 0;
+        memset(r->p->data + (res > 0 ? res : 0), 0, size - (res > 0 ? res : 0));
+    } else if (r->entry.raw) {
+        ok = res == (int) size;
+    } else {
+        ok = res == (int) r->entry.length && lz_decompress(r->packed, r->entry.length, r->p->data, size);
+    }
+
+    read_request_done(r, ok);
+}
+
+void *read_ahead_reaper(void *arg) {
+    (void) arg;
+    register_thread_stats();
+    for (;;) {
+        if (syscall(__NR_io_uring_enter, read_ahead.ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR) {
+            return NULL;
+        }
+
+        size_t reaped = 0;
+        unsigned head = *read_ahead.cq_head;
+        while (head != __atomic_load_n(read_ahead.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &read_ahead.cqes[head & *read_ahead.cq_mask];
+            read_request *r = (read_request *) (uintptr_t) cqe->user_data;
+            int res = cqe->res;
+            __atomic_store_n(read_ahead.cq_head, ++head, __ATOMIC_RELEASE);
+
+            read_request_complete(r, res);
+            reaped++;
+        }
+
+        pthread_mutex_lock(&read_ahead.lock);
+        read_ahead.in_flight -= reaped;
+        pthread_mutex_unlock(&read_ahead.lock);
+    }
+}
+
+void *read_ahead_worker(void *arg) {
+    (void) arg;
+    register_thread_stats();
+    for (;;) {
+        pthread_mutex_lock(&read_ahead.lock);
+        while (read_ahead.head == NULL) {
+            pthread_cond_wait(&read_ahead.queued, &read_ahead.lock);
+        }
+        read_request *r = read_ahead.head;
+        read_ahead.head = r->next;
+        if (read_ahead.head == NULL) {
+            read_ahead.tail = NULL;
+        }
+        pthread_mutex_unlock(&read_ahead.lock);
+
+        ssize_t n = pread(r->fd, r->buffer, r->length, r->pos);
+        read_request_complete(r, (int) n);
+
+        pthread_mutex_lock(&read_ahead.lock);
+        read_ahead.in_flight--;
+        pthread_mutex_unlock(&read_ahead.lock);
+    }
+}
+
+bool read_ahead_setup_uring(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int) syscall(__NR_io_uring_setup, READ_AHEAD_DEPTH, &params);
+    if (fd < 0) {
+        return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uint8_t *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    uint8_t *cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    read_ahead.ring_fd = fd;
+    read_ahead.entries = params.sq_entries;
+    read_ahead.sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    read_ahead.sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    read_ahead.sq_array = (unsigned *) (sq + params.sq_off.array);
+    read_ahead.sqes = sqes;
+    read_ahead.cq_head = (unsigned *) (cq + params.cq_off.head);
+    read_ahead.cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    read_ahead.cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    read_ahead.cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, read_ahead_reaper, NULL) != 0) {
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+void read_ahead_setup(void) {
+    if (read_ahead.mode == read_ahead_uring && read_ahead_setup_uring()) {
+        return;
+    }
+    if (read_ahead.mode != read_ahead_off) {
+        read_ahead.mode = read_ahead_threads;
+        int started = 0;
+        for (int i = 0; i < READ_AHEAD_THREADS; i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, read_ahead_worker, NULL) == 0) {
+                pthread_detach(thread);
+                started++;
+            }
+        }
+        if (started > 0) {
+            return;
+        }
+    }
+    read_ahead.mode = read_ahead_off;
+}
+
+// Resolves where a page lives now, so the read itself only has to fill the
+// frame or the packed buffer.
+bool read_request_prepare(read_request *r) {
+    const table_handle *h = r->h;
+    size_t size = h->rows_per_page * h->row_size;
+
+    r->fd = h->fd;
+    r->pos = page_offset(h, r->p->number);
+    r->buffer = r->p->data;
+    r->length = size;
+
+    r->sealed = h->info.compressed && r->p->number < __atomic_load_n(&h->sealed_blocks, __ATOMIC_ACQUIRE);
+    if (r->sealed) {
+        if (pread(h->dir_fd, &r->entry, sizeof(r->entry), (off_t) (r->p->number * sizeof(r->entry))) !=
+            sizeof(r->entry)) {
+            return false;
+        }
+        r->fd = h->block_fd;
+        r->pos = (off_t) r->entry.offset;
+        r->length = r->entry.length;
+        if (!r->entry.raw) {
+            r->buffer = r->packed = malloc(r->length);
+        }
+    }
+    return true;
+}
+
+// Counts a read going out, with read_ahead.lock held.
+void read_ahead_count_submit(void) {
+    if (++read_ahead.in_flight > read_ahead.peak_in_flight) {
+        read_ahead.peak_in_flight = read_ahead.in_flight;
+    }
+}
+
+bool read_ahead_submit(read_request *r) {
+    pthread_mutex_lock(&read_ahead.lock);
+
+    if (read_ahead.mode == read_ahead_threads) {
+        r->next = NULL;
+        if (read_ahead.tail != NULL) {
+            read_ahead.tail->next = r;
+        } else {
+            read_ahead.head = r;
+        }
+        read_ahead.tail = r;
+        read_ahead_count_submit();
+        pthread_cond_signal(&read_ahead.queued);
+        pthread_mutex_unlock(&read_ahead.lock);
+        return true;
+    }
+
+    if (read_ahead.in_flight >= read_ahead.entries) {
+        pthread_mutex_unlock(&read_ahead.lock);
+        return false;
+    }
+    unsigned tail = *read_ahead.sq_tail;
+    unsigned index = tail & *read_ahead.sq_mask;
+    struct io_uring_sqe *sqe = &read_ahead.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = r->fd;
+    sqe->off = (uint64_t) r->pos;
+    sqe->addr = (uint64_t) (uintptr_t) r->buffer;
+    sqe->len = (unsigned) r->length;
+    sqe->user_data = (uint64_t) (uintptr_t) r;
+    read_ahead.sq_array[index] = index;
+    __atomic_store_n(read_ahead.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    bool ok = syscall(__NR_io_uring_enter, read_ahead.ring_fd, 1, 0, 0, NULL, 0) == 1;
+    if (ok) {
+        read_ahead_count_submit();
+    } else {
+        // the kernel did not take the entry; take it back
+        __atomic_store_n(read_ahead.sq_tail, tail, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&read_ahead.lock);
+    return ok;
+}
+
+// Starts reading a page into the cache without waiting for it. A scan that
+// reaches the page before the read completes waits on the frame like it would
+// for any other session loading it.
+void page_prefetch(table_handle *h, size_t number) {
+    pthread_once(&read_ahead.once, read_ahead_setup);
+    if (read_ahead.mode == read_ahead_off) {
+        return;
+    }
+
+    pthread_mutex_lock(&page_cache.lock);
+    page *p;
+    for (p = *page_bucket(h->id, number); p != NULL; p = p->next) {
+        if (p->handle == h->id && p->number == number) {
+            break;
+        }
+    }
+    if (p != NULL || (p = page_evict()) == NULL) {
+        pthread_mutex_unlock(&page_cache.lock);
+        return;
+    }
+
+    page **bucket = page_bucket(h->id, number);
+    p->handle = h->id;
+    p->number = number;
+    p->pins = 0;
+    p->loading = true;
+    p->stale = false;
+    p->referenced = true;
+    p->next = *bucket;
+    *bucket = p;
+    pthread_mutex_unlock(&page_cache.lock);
+
+    page_reserve(h, p);
+    catalog_retain(h);
+
+    read_request *r = calloc(1, sizeof(read_request));
+    r->h = h;
+    r->p = p;
+    bool prepared = read_request_prepare(r);
+    size_t length = r->length;
+    if (prepared && read_ahead_submit(r)) {
+        counters.pages_read_ahead++;
+        counters.page_reads++;
+        counters.bytes_read += length;
+        return;
+    }
+    // no room in the ring; read it here, the scan needs it shortly anyway
+    read_request_done(r, false);
+}
+
+// Replaces a table: new sessions load the new definition, while sessions still
+// using the old handle keep reading the old data file through their snapshot.
+bool catalog_replace(const table_info *t) {
+    pthread_mutex_lock(&catalog.lock);
+    table_handle *h = catalog.handles;
+    while (h != NULL && strcmp(h->info.name, t->name) != 0) {
+        h = h->next;
+    }
+    if (h != NULL) {
+        h->refs++;
+    }
+    pthread_mutex_unlock(&catalog.lock);
+
+    if (h != NULL) {
+        pthread_rwlock_wrlock(&h->schema_lock);
+    }
+
+    char fname[FILENAME_MAX];
+    sprintf(fname, "%s.bin", t->name);
+
+    pthread_mutex_lock(&catalog.lock);
+    bool ok = write_table_info(t);
+    if (ok) {
+        unlink(fname);
+        sprintf(fname, "%s.zblk", t->name);
+        unlink(fname);
+        sprintf(fname, "%s.zdir", t->name);
+        unlink(fname);
+        sprintf(fname, "%s.dict", t->name);
+        unlink(fname);
+        sprintf(fname, "%s.zone", t->name);
+        unlink(fname);
+        sprintf(fname, "%s.del", t->name);
+        unlink(fname);
+    }
+
+    bool unlinked = false;
+    for (table_handle **hp = &catalog.handles; ok && h != NULL && *hp != NULL; hp = &(*hp)->next) {
+        if (*hp == h) {
+            *hp = h->next;
+            unlinked = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&catalog.lock);
+
+    if (h != NULL) {
+        h->dropped = ok;
+        pthread_rwlock_unlock(&h->schema_lock);
+        if (unlinked) {
+            catalog_release(h);
+        }
+        catalog_release(h);
+    }
+
+    return ok;
+}
+
+// Copies the tombstones of the rows a view sees; a view of a table without
+// deleted rows has none.
+void snapshot_tombstones(table *t) {
+    table_handle *h = t->handle;
+    free(t->deleted);
+    t->deleted = NULL;
+
+    pthread_mutex_lock(&h->delete_lock);
+    if (h->n_deleted > 0) {
+        size_t size = (t->info.n_rows + 7) / 8;
+        t->deleted = calloc(size + 1, 1);
+        memcpy(t->deleted, h->deleted, size < h->deleted_size ? size : h->deleted_size);
+    }
+    pthread_mutex_unlock(&h->delete_lock);
+}
+
+// Brings a view up to date with its table, for a writer that holds the
+// append lock.
+void refresh_view(table *t) {
+    t->info.n_rows = __atomic_load_n(&t->handle->committed_rows, __ATOMIC_ACQUIRE);
+    snapshot_tombstones(t);
+}
+
+bool row_deleted(const table *t, size_t row) {
+    return t->deleted != NULL && (t->deleted[row / 8] >> (row % 8) & 1);
+}
+
+table *open_table(const char *name) {
+    table_handle *h = catalog_acquire(name);
+
+    if (h == NULL) {
+        return NULL;
+    }
+
+    table *t = (table *) malloc(sizeof(table));
+
+    t->info = h->info;
+    t->info.n_rows = __atomic_load_n(&h->committed_rows, __ATOMIC_ACQUIRE);
+    t->temporary = false;
+    t->handle = h;
+    t->page = NULL;
+    t->data = NULL;
+    t->capacity = 0;
+    memcpy(t->dicts, h->dicts, sizeof(t->dicts));
+    t->read_ahead = 0;
+    t->deleted = NULL;
+    t->hash = NULL;
+    t->source = NULL;
+    snapshot_tombstones(t);
+    return t;
+}
+
+void close_table(table *t) {
+    if (t == NULL) {
+        return;
+    }
+
+    if (t->temporary) {
+        count_temp_bytes(0, t->capacity);
+        free(t->data);
+    } else {
+        if (t->page != NULL) {
+            page_unpin(t->page);
+        }
+        catalog_release(t->handle);
+    }
+    if (t->hash != NULL) {
+        close_hash_index(t->hash);
+        close_table(t->source);
+    }
+    free(t->deleted);
+    free(t);
+}
+
+void table_read_ahead(table *t, size_t number) {
+    size_t n_pages = (t->info.n_rows + t->handle->rows_per_page - 1) / t->handle->rows_per_page;
+    size_t last = number + READ_AHEAD_PAGES < n_pages ? number + READ_AHEAD_PAGES : n_pages;
+
+    // start over when the scan has restarted behind what was requested
+    if (t->read_ahead <= number || t->read_ahead > number + READ_AHEAD_PAGES) {
+        t->read_ahead = number + 1;
+    }
+    for (; t->read_ahead < last; t->read_ahead++) {
+        page_prefetch(t->handle, t->read_ahead);
+    }
+}
+
+const uint8_t *temp_table_row(const table *t, size_t row) {
+    return t->data + row * row_size_2(t->info.n_fields, t->info.fields);
+}
+
+// Returns a pointer to a row of a table; for an on-disk table it stays valid
+// until the next call on t.
+const uint8_t *table_row(table *t, size_t row) {
+    if (t->temporary) {
+        return temp_table_row(t, row);
+    }
+
+    size_t number = row / t->handle->rows_per_page;
+
+    if (t->page == NULL || t->page->number != number) {
+        // stepping onto the next page looks like a sequential scan: keep the
+        // following pages on their way while this one is consumed
+        if (t->page != NULL && t->page->number + 1 == number) {
+            table_read_ahead(t, number);
+        }
+        if (t->page != NULL) {
+            page_unpin(t->page);
+        }
+        t->page = page_pin(t->handle, number);
+    }
+
+    return t->page->data + (row % t->handle->rows_per_page) * t->handle->row_size;
+}
+
+bool write_table_row(const table_handle *h, size_t row, const uint8_t *data) {
+    size_t size = h->row_size;
+    // a compressed table's data file only holds the block being filled
+    size_t pos = h->info.compressed ? row % h->rows_per_page : row;
+
+    if (pwrite(h->fd, data, size, DATA_HEADER_SIZE + (off_t) (pos * size)) != (ssize_t) size) {
+        return false;
+    }
+
+    page_write_row(h, row, data);
+    return true;
+}
+
+// Compresses the full block in the data file into the block file so that the
+// data file can take the next block. Called with the append lock held.
+bool seal_block(table_handle *h) {
+    size_t number = h->sealed_blocks;
+    size_t size = h->rows_per_page * h->row_size;
+    uint8_t *data = malloc(size);
+    uint8_t *packed = malloc(lz_bound(size));
+
+    block_entry e;
+    e.offset = (uint64_t) h->block_end;
+    bool ok = pread(h->fd, data, size, page_offset(h, number)) == (ssize_t) size;
+    if (ok) {
+        size_t length = lz_compress(data, size, packed);
+        e.raw = length >= size;
+        e.length = e.raw ? size : length;
+        ok = pwrite(h->block_fd, e.raw ? data : packed, e.length, (off_t) e.offset) == (ssize_t) e.length &&
+             pwrite(h->dir_fd, &e, sizeof(e), (off_t) (number * sizeof(e))) == sizeof(e);
+    }
+
+    free(data);
+    free(packed);
+
+    if (ok) {
+        h->block_end += e.length;
+        // readers load the block from the block file from now on
+        __atomic_store_n(&h->sealed_blocks, number + 1, __ATOMIC_RELEASE);
+        page_invalidate(h, number);
+    }
+    return ok;
+}
+
+// Widens the zones of a row's block to cover it, before the row is written.
+// A block whose first row was inserted without zones never gets any. Called
+// with the append lock held.
+bool zone_add_row(table_handle *h, size_t row, const uint8_t *values) {
+    size_t block = row / h->rows_per_page;
+    bool ok = true;
+
+    pthread_mutex_lock(&h->zone_lock);
+    if (block >= h->zone_capacity) {
+        size_t capacity = 2 * h->zone_capacity > block ? 2 * h->zone_capacity : block + 1;
+        h->zones = realloc(h->zones, capacity * h->zone_size);
+        memset(h->zones + h->zone_capacity * h->zone_size, 0, (capacity - h->zone_capacity) * h->zone_size);
+        h->zone_capacity = capacity;
+    }
+    if (block >= h->n_zone_blocks) {
+        h->n_zone_blocks = block + 1;
+    }
+
+    uint8_t *record = h->zones + block * h->zone_size;
+    zone *zones = (zone *) (record + sizeof(uint64_t));
+    uint64_t valid;
+    memcpy(&valid, record, sizeof(valid));
+
+    bool changed = false;
+    if (row % h->rows_per_page == 0) {
+        valid = 1;
+        memcpy(record, &valid, sizeof(valid));
+        for (int i = 0; i < h->info.n_fields; i++) {
+            zone_init(&zones[i], &h->info.fields[i], values + seek_pos(h->info, 0, i));
+        }
+        changed = true;
+    } else if (valid) {
+        for (int i = 0; i < h->info.n_fields; i++) {
+            changed |= zone_add(&zones[i], &h->info.fields[i], values + seek_pos(h->info, 0, i));
+        }
+    }
+
+    if (changed) {
+        ssize_t size = (ssize_t) h->zone_size;
+        ok = pwrite(h->zone_fd, record, size, (off_t) (block * h->zone_size)) == size;
+    }
+    pthread_mutex_unlock(&h->zone_lock);
+    return ok;
+}
+
+// Copies the zone of a column for a block whose rows all have been summarized.
+bool table_zone(const table *t, size_t block, int col, zone *z) {
+    table_handle *h = t->handle;
+    pthread_mutex_lock(&h->zone_lock);
+
+    bool found = false;
+    if (block < h->n_zone_blocks) {
+        uint8_t *record = h->zones + block * h->zone_size;
+        uint64_t valid;
+        memcpy(&valid, record, sizeof(valid));
+        if (valid) {
+            memcpy(z, record + sizeof(uint64_t) + col * sizeof(zone), sizeof(zone));
+            found = true;
+        }
+    }
+
+    pthread_mutex_unlock(&h->zone_lock);
+    return found;
+}
+
+// Stores the code of value in raw, adding the value to the column's
+// dictionary first if needed. Called with the append lock held.
+bool dictionary_encode(table_handle *h, int col, const char *value, uint8_t *raw) {
+    dictionary *d = h->dicts[col];
+    char entry[MAX_FIELD_LENGTH + 1] = {0};
+    strncpy(entry, value, d->width - 1);
+
+    int code = dictionary_find(d, entry);
+    if (code == -1) {
+        if (d->n_entries == DICT_MAX_ENTRIES) {
+            fprintf(stderr, "Dictionary of %s.%s is full\n", h->info.name, h->info.fields[col].name);
+            return false;
+        }
+
+        uint8_t record[sizeof(uint32_t) + MAX_FIELD_LENGTH + 1];
+        uint32_t c = (uint32_t) col;
+        memcpy(record, &c, sizeof(c));
+        memcpy(record + sizeof(c), entry, d->width);
+        ssize_t size = (ssize_t) (sizeof(c) + d->width);
+        if (pwrite(h->dict_fd, record, size, h->dict_end) != size) {
+            return false;
+        }
+        h->dict_end += size;
+        code = dictionary_add(d, entry);
+    }
+
+    uint16_t stored = (uint16_t) code;
+    memcpy(raw, &stored, sizeof(stored));
+    return true;
+}
+
+bool parse_create(session *s, const char *input) {
+    //puts("CREATE");
+    int n;
+    table_info t_info;
+    char option[16] = {0};
+    memset(&t_info, 0, sizeof(table_info));
+    t_info.n_fields = 0;
+    t_info.n_rows = 0;
+    n = sscanf(input, "CREATE TABLE %31s %15s", t_info.name, option);
+
+    if (n < 1 || (n == 2 && strcmp(option, "UNCOMPRESSED") != 0)) {
+        return false;
+    }
+    t_info.compressed = n == 1;
+
+    char ib[INPUT_BUFFER_SIZE];
+    int i = 0;
+
+    do {
+        if (fgets(ib, INPUT_BUFFER_SIZE, s->in) == NULL) {
+            return false;
+        }
+        str_trim(ib);
+
+#ifndef QUIET
+        printf("===> %s\n", ib);
+#endif
+
+        if (starts_with("ADD", ib) && i < MAX_TABLE_FIELDS) {
+            char field_type[16];
+            char encoding[16];
+            n = sscanf(ib, "ADD %31s %15s %lu %15s", t_info.fields[i].name, field_type, &t_info.fields[i].length,
+                       encoding);
+            if (n < 3) {
+                return false;
+            }
+            t_info.fields[i].type = str_to_field_type(field_type);
+            if (n == 4) {
+                if (strcmp(encoding, "DICTIONARY") != 0 || t_info.fields[i].type != field_type_char) {
+                    return false;
+                }
+                t_info.fields[i].dictionary = true;
+            }
+            i++;
+            t_info.n_fields++;
+        }
+
+    } while (strcmp(ib, "END") != 0);
+
+    return catalog_replace(&t_info);
+}
+
+// Stores a value the way a field without a dictionary keeps it.
+void encode_value(const field *f, const char *value, uint8_t *raw) {
+    size_t f_size = field_size(*f);
+    size_t len = strlen(value);
+    int64_t long_val;
+
+    memset(raw, 0, f_size);
+    switch (f->type) {
+        case field_type_char:
+            memcpy(raw, value, len < f_size ? len : f_size - 1);
+            break;
+        case field_type_integer:
+            long_val = strtoll(value, NULL, 10);
+            memcpy(raw, &long_val, f_size);
+            break;
+        case field_type_undefined:
+            // do nothing
+            break;
+    }
+}
+
+// Stores a value the way its column keeps it. Called with the append lock held.
+bool encode_field(table_handle *h, int col, const char *value, uint8_t *raw) {
+    if (h->info.fields[col].dictionary) {
+        memset(raw, 0, field_size(h->info.fields[col]));
+        return dictionary_encode(h, col, value, raw);
+    }
+    encode_value(&h->info.fields[col], value, raw);
+    return true;
+}
+
+// Adds a row to the hash indexes of its table. Called with the append lock
+// held.
+bool index_row(table_handle *h, size_t row, const uint8_t *values) {
+    if (h->hash_indexes == NULL) {
+        return true;
+    }
+
+    bool ok = true;
+    pthread_rwlock_wrlock(&index_lock);
+    for (hash_index *ix = h->hash_indexes; ok && ix != NULL; ix = ix->next) {
+        uint8_t *entry = malloc(ix->entry_size);
+        hash_entry(ix, &h->info, h->dicts, values, row, entry);
+        ok = hash_insert(ix, entry);
+        free(entry);
+    }
+    pthread_rwlock_unlock(&index_lock);
+    return ok;
+}
+
+// Appends an encoded row and publishes it to views opened from now on.
+// Called with the append lock held.
+bool append_row(table_handle *h, const uint8_t *values) {
+    size_t row = h->committed_rows;
+    bool ok = true;
+    while (ok && h->info.compressed && h->sealed_blocks < row / h->rows_per_page) {
+        ok = seal_block(h);
+    }
+    // a row indexed but not committed is reused by the next insert; readers
+    // of the hash indexes tell its stale entries by their values
+    ok = ok && zone_add_row(h, row, values) && write_table_row(h, row, values) && index_row(h, row, values) &&
+         write_row_count(h, row + 1);
+    if (ok) {
+        __atomic_store_n(&h->committed_rows, row + 1, __ATOMIC_RELEASE);
+    }
+    return ok;
+}
+
+// Sets the tombstone of a row. Called with the append lock held.
+bool delete_row(table_handle *h, size_t row) {
+    size_t byte = row / 8;
+    uint8_t bit = (uint8_t) (1 << (row % 8));
+    bool ok = true;
+
+    pthread_mutex_lock(&h->delete_lock);
+    if (byte >= h->deleted_size) {
+        size_t size = 2 * h->deleted_size > byte ? 2 * h->deleted_size : byte + 1;
+        h->deleted = realloc(h->deleted, size + 1);
+        memset(h->deleted + h->deleted_size, 0, size + 1 - h->deleted_size);
+        h->deleted_size = size;
+    }
+    if (!(h->deleted[byte] & bit)) {
+        uint8_t value = h->deleted[byte] | bit;
+        ok = pwrite(h->del_fd, &value, 1, (off_t) byte) == 1;
+        if (ok) {
+            h->deleted[byte] = value;
+            h->n_deleted++;
+        }
+    }
+    pthread_mutex_unlock(&h->delete_lock);
+    return ok;
+}
+
+// Opens a table to change it, holding its schema lock shared, or exclusively
+// to rewrite it. Retries when the table is replaced meanwhile.
+table *open_table_for_write(const char *name, bool exclusive) {
+    table *t;
+    while ((t = open_table(name)) != NULL) {
+        if (exclusive) {
+            pthread_rwlock_wrlock(&t->handle->schema_lock);
+        } else {
+            pthread_rwlock_rdlock(&t->handle->schema_lock);
+        }
+        if (!t->handle->dropped) {
+            break;
+        }
+        // replaced while we were opening it; retry with the new definition
+        pthread_rwlock_unlock(&t->handle->schema_lock);
+        close_table(t);
+    }
+    return t;
+}
+
+bool parse_insert(const char *input) {
+    char table_name[MAX_TABLE_NAME_SIZE];
+    char insert_data[INPUT_BUFFER_SIZE];
+    int n = sscanf(input, "INSERT INTO %s %[^\n]%*c", table_name, insert_data);
+    if (n != 2) {
+        return false;
+    }
+
+    table *t = open_table_for_write(table_name, false);
+
+    if (t != NULL) {
+        //show_table_info(&t);
+        table_handle *h = t->handle;
+        uint8_t *values = calloc(row_size(t->info), 1);
+        bool ok = true;
+
+        // new dictionary values are added under the append lock
+        pthread_mutex_lock(&h->append_lock);
+
+        char *save = NULL;
+        for (int i = 0; ok && i < t->info.n_fields; i++) {
+            char *tok = strtok_r(i == 0 ? insert_data : NULL, ",", &save);
+            if (tok == NULL) {
+                // missing values are empty
+                tok = "";
+            }
+            ok = encode_field(h, i, tok, values + seek_pos(t->info, 0, i));
+        }
+
+        ok = ok && append_row(h, values);
+        if (ok) {
+            counters.rows_inserted++;
+        }
+
+        pthread_mutex_unlock(&h->append_lock);
+        pthread_rwlock_unlock(&h->schema_lock);
+
+        free(values);
+        close_table(t);
+        return ok;
+    }
+
+    return false;
+}
+
+void decode_field(char *output, const uint8_t *raw, field_type f) {
+    counters.cells_decoded++;
+    switch (f) {
+        case field_type_char:
+            strcpy(output, (char *) raw);
+            break;
+        case field_type_integer:
+            sprintf(output, "%" PRIi64, *((int64_t *) raw));
+            break;
+        case field_type_undefined:
+            sprintf(output, "undefined");
+    }
+}
+
+bool read_field(uint8_t *raw, table *t, size_t row, int col) {
+    size_t size = field_size(t->info.fields[col]);
+    memcpy(raw, table_row(t, row) + seek_pos(t->info, 0, col), size);
+    counters.field_bytes_read += size;
+    return true;
+}
+
+// Decodes a raw field of t, looking dictionary codes up in its dictionary.
+void decode_table_field(char *output, const table *t, int col, const uint8_t *raw) {
+    if (t->info.fields[col].dictionary) {
+        strcpy(output, dictionary_value(t->dicts[col], field_code(raw)));
+        counters.cells_decoded++;
+    } else {
+        decode_field(output, raw, t->info.fields[col].type);
+    }
+}
+
+table *create_temp_table(int n_fields, field fields[], size_t n_rows) {
+    table *temp = malloc(sizeof(table));
+    temp->capacity = row_size_2(n_fields, fields) * n_rows * sizeof(uint8_t);
+    temp->data = malloc(temp->capacity);
+    count_temp_bytes(temp->capacity, 0);
+    temp->info.name[0] = 0;
+    temp->info.n_rows = 0;
+    temp->info.n_fields = n_fields;
+    temp->temporary = true;
+    temp->handle = NULL;
+    temp->page = NULL;
+    temp->deleted = NULL;
+    temp->hash = NULL;
+    temp->source = NULL;
+    memset(temp->dicts, 0, sizeof(temp->dicts));
+    memcpy(temp->info.fields, fields, sizeof(field) * n_fields);
+    return temp;
+}
+
+void set_temp_table_field(table *t, size_t row, int col, uint8_t *value) {
+    size_t offset = mem_offset(t->info.n_fields, t->info.fields, row, col);
+    memcpy(t->data + offset, value, field_size(t->info.fields[col]));
+}
+
+void decode_temp_table_field(char *dest, table *t, size_t row, int col) {
+    size_t offset = mem_offset(t->info.n_fields, t->info.fields, row, col);
+    uint8_t *value = alloca(field_size(t->info.fields[col]));
+    memcpy(value, t->data + offset, field_size(t->info.fields[col]));
+    decode_table_field(dest, t, col, value);
+}
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+} byte_buffer;
+
+uint8_t *buffer_reserve(byte_buffer *b, size_t n) {
+    if (b->length + n > b->capacity) {
+        size_t capacity = b->capacity > 0 ? b->capacity : 4096;
+        while (b->length + n > capacity) {
+            capacity *= 2;
+        }
+        b->data = realloc(b->data, capacity);
+        b->capacity = capacity;
+    }
+    return b->data + b->length;
+}
+
+void buffer_append(byte_buffer *b, const void *data, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    memcpy(buffer_reserve(b, n), data, n);
+    b->length += n;
+}
+
+size_t format_int64(char *out, int64_t value) {
+    char digits[20];
+    uint64_t u = value < 0 ? -(uint64_t) value : (uint64_t) value;
+    size_t n = 0;
+    do {
+        digits[n++] = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u > 0);
+
+    size_t length = 0;
+    if (value < 0) {
+        out[length++] = '-';
+    }
+    while (n > 0) {
+        out[length++] = digits[--n];
+    }
+    return length;
+}
+
+// Writes the rows of a result straight from the raw bytes of its table into
+// one large buffer, which goes out to the session's stream in big writes.
+//
+// The binary format is columnar, native little-endian and unaligned:
+//   "DBCOLS01", uint32 n_columns, per column uint8 type (0 char, 1 integer),
+//   uint8 name length and the name;
+//   batches of uint32 n_rows, then per column either int64 values[n_rows] or
+//   uint32 offsets[n_rows + 1] followed by offsets[n_rows] bytes of text;
+//   a batch of 0 rows and a newline end the result, so a server response still
+//   ends on a line of its own.
+typedef struct {
+    FILE *out;
+    output_format format;
+    const table *table;
+    int n_columns;
+    int cols[SELECT_MAX];
+    size_t offsets[SELECT_MAX];
+    field_type types[SELECT_MAX];
+    byte_buffer buffer;
+    size_t n_rows;
+    byte_buffer values[SELECT_MAX];
+    byte_buffer ends[SELECT_MAX];
+    bool ok;
+} result_writer;
+
+bool writer_flush(result_writer *w) {
+    if (w->buffer.length > 0 && fwrite(w->buffer.data, 1, w->buffer.length, w->out) != w->buffer.length) {
+        w->ok = false;
+    }
+    w->buffer.length = 0;
+    return w->ok;
+}
+
+void writer_flush_batch(result_writer *w) {
+    uint32_t n_rows = (uint32_t) w->n_rows;
+    buffer_append(&w->buffer, &n_rows, sizeof(n_rows));
+    for (int j = 0; j < w->n_columns; j++) {
+        if (w->types[j] == field_type_char) {
+            uint32_t start = 0;
+            buffer_append(&w->buffer, &start, sizeof(start));
+            buffer_append(&w->buffer, w->ends[j].data, w->ends[j].length);
+            w->ends[j].length = 0;
+        }
+        buffer_append(&w->buffer, w->values[j].data, w->values[j].length);
+        w->values[j].length = 0;
+    }
+    w->n_rows = 0;
+    writer_flush(w);
+}
+
+// Columns are q's fields, read from cols of t: the queried table itself, or
+// the temporary table holding an index or a join result.
+void writer_begin(result_writer *w, session *s, const query *q, const table *t, const int *cols) {
+    memset(w, 0, sizeof(*w));
+    w->out = s->out;
+    w->format = s->format;
+    w->table = t;
+    w->n_columns = q->n_fields;
+    w->ok = true;
+    for (int j = 0; j < q->n_fields; j++) {
+        w->cols[j] = cols[j];
+        w->offsets[j] = mem_offset(t->info.n_fields, t->info.fields, 0, cols[j]);
+        w->types[j] = t->info.fields[cols[j]].type;
+    }
+
+    if (w->format == output_binary) {
+        uint32_t n_columns = (uint32_t) w->n_columns;
+        buffer_append(&w->buffer, "DBCOLS01", 8);
+        buffer_append(&w->buffer, &n_columns, sizeof(n_columns));
+        for (int j = 0; j < w->n_columns; j++) {
+            uint8_t header[2] = {w->types[j] == field_type_integer ? 1 : 0, (uint8_t) strlen(q->fields[j].field)};
+            buffer_append(&w->buffer, header, sizeof(header));
+            buffer_append(&w->buffer, q->fields[j].field, header[1]);
+        }
+    }
+}
+
+void writer_row(result_writer *w, const uint8_t *row) {
+    for (int j = 0; j < w->n_columns; j++) {
+        const uint8_t *raw = row + w->offsets[j];
+        const field *f = &w->table->info.fields[w->cols[j]];
+        byte_buffer *b = w->format == output_text ? &w->buffer : &w->values[j];
+
+        if (w->format == output_text && j > 0) {
+            *buffer_reserve(b, 1) = ',';
+            b->length++;
+        }
+        if (f->type == field_type_integer) {
+            int64_t value;
+            memcpy(&value, raw, sizeof(value));
+            if (w->format == output_text) {
+                b->length += format_int64((char *) buffer_reserve(b, 20), value);
+            } else {
+                buffer_append(b, &value, sizeof(value));
+            }
+        } else {
+            const char *text = f->dictionary ? dictionary_value(w->table->dicts[w->cols[j]], field_code(raw))
+                                             : (const char *) raw;
+            buffer_append(b, text, strnlen(text, f->dictionary ? MAX_FIELD_LENGTH : f->length + 1));
+            if (w->format == output_binary) {
+                uint32_t end = (uint32_t) b->length;
+                buffer_append(&w->ends[j], &end, sizeof(end));
+            }
+        }
+    }
+
+    if (w->format == output_text) {
+        *buffer_reserve(&w->buffer, 1) = '\n';
+        w->buffer.length++;
+        if (w->buffer.length >= OUTPUT_BUFFER_SIZE) {
+            writer_flush(w);
+        }
+    } else if (++w->n_rows == OUTPUT_BATCH_ROWS) {
+        writer_flush_batch(w);
+    }
+    counters.cells_decoded += w->n_columns;
+}
+
+bool writer_end(result_writer *w) {
+    if (w->format == output_binary) {
+        if (w->n_rows > 0) {
+            writer_flush_batch(w);
+        }
+        uint32_t end = 0;
+        buffer_append(&w->buffer, &end, sizeof(end));
+        buffer_append(&w->buffer, "\n", 1);
+    }
+    writer_flush(w);
+
+    free(w->buffer.data);
+    for (int j = 0; j < w->n_columns; j++) {
+        free(w->values[j].data);
+        free(w->ends[j].data);
+    }
+    return w->ok;
+}
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void describe_literal(char *buf, size_t size, const literal *lit) {
+    snprintf(buf, size, lit->type == literal_type_constant ? "\"%s\"" : "%s", lit->value);
+}
+
+void describe_condition(char *buf, size_t size, const query_condition *c) {
+    char lit1[MAX_FIELD_LENGTH + 2];
+    char lit2[MAX_FIELD_LENGTH + 2];
+    describe_literal(lit1, sizeof(lit1), &c->literal1);
+    describe_literal(lit2, sizeof(lit2), &c->literal2);
+    snprintf(buf, size, "%s = %s", lit1, lit2);
+}
+
+// The detail of a Filter operator, "table: condition"; the condition is cut
+// to what fits after the longest table name.
+void describe_filter(char *buf, size_t size, const query_condition *c) {
+    char cond[MAX_FIELD_LENGTH * 2 + 8];
+    describe_condition(cond, sizeof(cond), c);
+    snprintf(buf, size, "%s: %.*s", c->literal1.table->info.name, (int) (size - MAX_TABLE_NAME_SIZE - 2), cond);
+}
+
+void describe_conditions(char *buf, size_t size, const query *q) {
+    size_t len = snprintf(buf, size, "%s", q->tables[0]->info.name);
+    for (int i = 0; i < q->n_conditions && len < size; i++) {
+        char cond[MAX_FIELD_LENGTH * 2 + 8];
+        describe_condition(cond, sizeof(cond), &q->conditions[i]);
+        len += snprintf(buf + len, size - len, "%s%s", i == 0 ? ": " :
+                        q->conditions[i].conjunction == conjunction_and ? " AND " : " OR ", cond);
+    }
+}
+
+void describe_fields(char *buf, size_t size, const query *q) {
+    size_t len = 0;
+    buf[0] = 0;
+    for (int i = 0; i < q->n_fields && len < size; i++) {
+        len += snprintf(buf + len, size - len, "%s%s", i == 0 ? "" : ", ", q->fields[i].field);
+    }
+}
+
+operator_stats *stats_add(query_stats *stats, const char *name, const char *detail) {
+    if (stats == NULL || stats->n_ops == STATS_MAX_OPS) {
+        return NULL;
+    }
+    operator_stats *op = &stats->ops[stats->n_ops++];
+    memset(op, 0, sizeof(operator_stats));
+    snprintf(op->name, sizeof(op->name), "%s", name);
+    snprintf(op->detail, sizeof(op->detail), "%s", detail);
+    return op;
+}
+
+void stats_resume(operator_stats *op) {
+    if (op != NULL) {
+        op->started_io = counters;
+        op->started = now();
+    }
+}
+
+void stats_pause(operator_stats *op) {
+    if (op != NULL) {
+        op->seconds += now() - op->started;
+        op->io.bytes_read += counters.bytes_read - op->started_io.bytes_read;
+        op->io.page_reads += counters.page_reads - op->started_io.page_reads;
+        op->io.page_hits += counters.page_hits - op->started_io.page_hits;
+        op->io.temp_bytes += counters.temp_bytes - op->started_io.temp_bytes;
+        op->io.blocks_skipped += counters.blocks_skipped - op->started_io.blocks_skipped;
+    }
+}
+
+operator_stats *stats_begin(query_stats *stats, const char *name, const char *detail) {
+    operator_stats *op = stats_add(stats, name, detail);
+    stats_resume(op);
+    return op;
+}
+
+void stats_end(operator_stats *op, size_t rows_in, size_t rows_out) {
+    if (op != NULL) {
+        stats_pause(op);
+        op->rows_in = rows_in;
+        op->rows_out = rows_out;
+    }
+}
+
+void query_columns(const query *q, int *cols) {
+    for (int j = 0; j < q->n_fields; j++) {
+        cols[j] = q->fields[j].col;
+    }
+}
+
+int strcmp_wrapper(const void *a, const void *b) {
+#ifdef DEBUG
+    printf("Comparing %s %s\n", (const char *) a, (const char *) b);
+#endif
+    return strcmp((const char *) a, (const char *) b);
+}
+
+// The files of a hash index mapped for reading, and its header as of then.
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    uint8_t *overflow;
+    size_t overflow_size;
+    hash_header header;
+} hash_mapping;
+
+void unmap_hash_index(hash_mapping *m) {
+    if (m->base != NULL && m->base != MAP_FAILED) {
+        munmap(m->base, m->size);
+    }
+    if (m->overflow != NULL && m->overflow != MAP_FAILED) {
+        munmap(m->overflow, m->overflow_size);
+    }
+}
+
+// Called with index_lock held shared, which keeps writers out until unmapped.
+bool map_hash_index(const hash_index *ix, hash_mapping *m) {
+    off_t size = lseek(ix->fd, 0, SEEK_END);
+    off_t overflow_size = lseek(ix->overflow_fd, 0, SEEK_END);
+    m->size = size > 0 ? (size_t) size : 0;
+    m->overflow_size = overflow_size > 0 ? (size_t) overflow_size : 0;
+    m->base = m->size >= sizeof(hash_header) ? mmap(NULL, m->size, PROT_READ, MAP_SHARED, ix->fd, 0) : MAP_FAILED;
+    m->overflow = m->overflow_size > 0 ? mmap(NULL, m->overflow_size, PROT_READ, MAP_SHARED, ix->overflow_fd, 0)
+                                       : NULL;
+
+    if (m->base == MAP_FAILED || m->overflow == MAP_FAILED) {
+        unmap_hash_index(m);
+        return false;
+    }
+    memcpy(&m->header, m->base, sizeof(hash_header));
+    return true;
+}
+
+// A bucket page, or the overflow page a chain links to; NULL past the end of
+// the files.
+const uint8_t *hash_mapped_page(const hash_mapping *m, bool overflow, uint64_t number) {
+    size_t page_size = m->header.page_size;
+    uint64_t index = overflow ? number - 1 : number + 1;
+    const uint8_t *base = overflow ? m->overflow : m->base;
+    size_t size = overflow ? m->overflow_size : m->size;
+    if (base == NULL || (index + 1) * page_size > size) {
+        return NULL;
+    }
+    return base + index * page_size;
+}
+
+// Whether the row of an entry was committed when the index was opened, has
+// not been deleted, and holds the values of the entry. An insert that dies
+// between indexing a row and committing it leaves an entry whose row id the
+// next insert reuses for other values.
+bool hash_entry_live(table *t, const uint8_t *entry) {
+    const hash_index *ix = t->hash;
+    uint64_t id;
+    memcpy(&id, entry + ix->entry_size - sizeof(id), sizeof(id));
+    if (t->source == NULL) {
+        return true;
+    }
+    if (id >= t->source->info.n_rows || row_deleted(t->source, id)) {
+        return false;
+    }
+
+    uint8_t expected[ix->entry_size];
+    hash_entry(ix, &t->source->info, t->source->dicts, table_row(t->source, id), id, expected);
+    return memcmp(expected, entry, ix->entry_size) == 0;
+}
+
+// Appends the live entries of a page, as rows of the index, to out; only
+// those whose key is key unless it is NULL.
+void hash_page_entries(table *t, const uint8_t *page, const uint8_t *key, byte_buffer *out) {
+    const hash_index *ix = t->hash;
+    size_t key_size = field_size(ix->header.info.fields[0]);
+    hash_page p;
+    memcpy(&p, page, sizeof(p));
+
+    for (uint32_t i = 0; i < p.count && i < ix->page_entries; i++) {
+        const uint8_t *entry = page + sizeof(p) + i * ix->entry_size;
+        if ((key == NULL || memcmp(entry, key, key_size) == 0) && hash_entry_live(t, entry)) {
+            buffer_append(out, entry, ix->entry_size - sizeof(uint64_t));
+        }
+    }
+}
+
+// Collects the rows of a hash index whose key is value, reading only its
+// bucket's chain. Returns the number of pages read.
+size_t hash_lookup(table *t, const char *value, byte_buffer *out) {
+    hash_index *ix = t->hash;
+    const field *f = &ix->header.info.fields[0];
+    uint8_t key[MAX_FIELD_LENGTH];
+    encode_value(f, value, key);
+    size_t pages = 0;
+
+    pthread_rwlock_rdlock(&index_lock);
+    hash_mapping m;
+    if (map_hash_index(ix, &m)) {
+        const uint8_t *page = hash_mapped_page(&m, false, hash_bucket(&m.header, hash_key(f, key)));
+        while (page != NULL) {
+            pages++;
+            counters.index_probes++;
+            hash_page_entries(t, page, key, out);
+            hash_page p;
+            memcpy(&p, page, sizeof(p));
+            page = p.overflow != 0 ? hash_mapped_page(&m, true, p.overflow) : NULL;
+        }
+        counters.bytes_read += pages * m.header.page_size;
+        unmap_hash_index(&m);
+    }
+    pthread_rwlock_unlock(&index_lock);
+    return pages;
+}
+
+// Loads every live row of a hash index, sorted like a sorted index, for the
+// queries that are not a lookup of its key.
+void load_hash_table(table *t) {
+    if (t->hash == NULL || t->data != NULL) {
+        return;
+    }
+
+    byte_buffer rows = {0};
+    buffer_reserve(&rows, 1);
+    pthread_rwlock_rdlock(&index_lock);
+    hash_mapping m;
+    if (map_hash_index(t->hash, &m)) {
+        uint64_t n_buckets = (UINT64_C(1) << m.header.level) + m.header.split;
+        for (uint64_t b = 0; b < n_buckets; b++) {
+            const uint8_t *page = hash_mapped_page(&m, false, b);
+            while (page != NULL) {
+                hash_page_entries(t, page, NULL, &rows);
+                hash_page p;
+                memcpy(&p, page, sizeof(p));
+                page = p.overflow != 0 ? hash_mapped_page(&m, true, p.overflow) : NULL;
+            }
+        }
+        counters.bytes_read += m.size + m.overflow_size;
+        unmap_hash_index(&m);
+    }
+    pthread_rwlock_unlock(&index_lock);
+
+    size_t size = row_size(t->info);
+    t->data = rows.data;
+    t->capacity = rows.capacity;
+    t->info.n_rows = rows.length / size;
+    count_temp_bytes(t->capacity, 0);
+    qsort(t->data, t->info.n_rows, size, strcmp_wrapper);
+}
+
+bool hash_query(session *s, query q, query_stats *stats) {
+    table *t = q.tables[0];
+    char detail[sizeof(((operator_stats *) 0)->detail)];
+    char fields[sizeof(detail)];
+    describe_conditions(detail, sizeof(detail), &q);
+    describe_fields(fields, sizeof(fields), &q);
+
+    int cols[SELECT_MAX];
+    query_columns(&q, cols);
+    result_writer w;
+    writer_begin(&w, s, &q, t, cols);
+
+    operator_stats *lookup = stats_begin(stats, "Hash Lookup", detail);
+    byte_buffer matches = {0};
+    size_t pages = hash_lookup(t, q.conditions[0].literal2.value, &matches);
+    size_t size = row_size(t->info);
+    size_t n = matches.length / size;
+    stats_end(lookup, pages, n);
+
+    operator_stats *project = stats_begin(stats, "Project", fields);
+    for (size_t i = 0; i < n; i++) {
+        writer_row(&w, matches.data + i * size);
+    }
+    stats_end(project, n, n);
+    free(matches.data);
+
+    return writer_end(&w);
+}
+
+bool index_query(session *s, query q, query_stats *stats) {
+    // only binary search for 1 row
+    table *t = q.tables[0];
+    char buf[MAX_FIELD_LENGTH];
+    char detail[sizeof(((operator_stats *) 0)->detail)];
+    char fields[sizeof(detail)];
+    describe_conditions(detail, sizeof(detail), &q);
+    describe_fields(fields, sizeof(fields), &q);
+
+    int cols[SELECT_MAX];
+    query_columns(&q, cols);
+    result_writer w;
+    writer_begin(&w, s, &q, t, cols);
+
+    if(q.n_conditions > 0 && t->info.n_rows > 0) {
+        query_condition c = q.conditions[0];
+        operator_stats *search = stats_begin(stats, "Index Search", detail);
+        size_t probes = 0;
+
+        size_t l = 0;
+        size_t r = t->info.n_rows - 1;
+        while (l <= r) {
+            size_t m = l + (r - l) / 2;
+            probes++;
+            counters.index_probes++;
+
+            if (s->format == output_text) {
+                fputs("TRACE: ", s->out);
+                for (int j = 0; j < q.n_fields; j++) {
+                    decode_temp_table_field(buf, t, m, q.fields[j].col);
+                    fprintf(s->out, "%s%s", j == 0 ? "" : ",", buf);
+                }
+                fputc('\n', s->out);
+            }
+
+            decode_temp_table_field(buf, t, m, 0);
+            int diff = strcmp(c.literal2.value, buf);
+            // Check if x is present at mid
+            if (diff == 0) {
+                stats_end(search, probes, 1);
+                operator_stats *project = stats_begin(stats, "Project", fields);
+                writer_row(&w, temp_table_row(t, m));
+                bool ok = writer_end(&w);
+                stats_end(project, 1, 1);
+                return ok;
+            }
+
+            if (diff > 0) {
+                l = m + 1;
+            } else if (m > 0) {
+                r = m - 1;
+            } else {
+                break;
+            }
+        }
+        stats_end(search, probes, 0);
+    } else {
+        operator_stats *scan = stats_begin(stats, "Index Scan", detail);
+        stats_end(scan, t->info.n_rows, t->info.n_rows);
+
+        operator_stats *project = stats_begin(stats, "Project", fields);
+        for (int i = 0; i < t->info.n_rows ; ++i) {
+            writer_row(&w, temp_table_row(t, i));
+        }
+        stats_end(project, t->info.n_rows, t->info.n_rows);
+    }
+
+    return writer_end(&w);
+}
+
+// The code a dictionary column is compared with for a field = constant
+// condition; -1 if no row holds the constant, NOT_ENCODED for a string compare.
+int condition_code(const table *t, const query_condition *c) {
+    if (c->literal1.type != literal_type_field || c->literal2.type != literal_type_constant ||
+        !t->info.fields[c->literal1.col].dictionary) {
+        return NOT_ENCODED;
+    }
+    return dictionary_find(t->dicts[c->literal1.col], c->literal2.value);
+}
+
+// Whether any row of a block can satisfy the conditions: each condition is
+// replaced by what the zones allow and folded the way row_matches folds them.
+bool block_may_match(const table *t, size_t block, const query *q, const zone_probe *probes) {
+    bool accept = true;
+    for (int k = 0; k < q->n_conditions; k++) {
+        bool result = true;
+        zone z;
+        if (probes[k].col != -1) {
+            result = !probes[k].never;
+            if (result && table_zone(t, block, probes[k].col, &z)) {
+                result = zone_may_contain(&z, &t->info.fields[probes[k].col], &probes[k]);
+            }
+        }
+        accept = q->conditions[k].conjunction == conjunction_and ? accept && result : accept || result;
+    }
+    return accept;
+}
+
+bool row_matches(table *t, size_t i, const query *q, const int *codes) {
+    uint8_t data[MAX_FIELD_LENGTH];
+
+    bool accept = true;
+    for (int k = 0; k < q->n_conditions; k++) {
+        char val1[MAX_FIELD_LENGTH];
+        char val2[MAX_FIELD_LENGTH];
+        bool result;
+
+        if (codes[k] != NOT_ENCODED) {
+            read_field(data, t, i, q->conditions[k].literal1.col);
+            result = field_code(data) == codes[k];
+        } else {
+            if (q->conditions[k].literal1.type == literal_type_field) {
+                read_field(data, t, i, q->conditions[k].literal1.col);
+                decode_table_field(val1, t, q->conditions[k].literal1.col, data);
+            } else {
+                strcpy(val1, q->conditions[k].literal1.value);
+                val1[strlen(val1) - 1] = 0;
+            }
+
+            if (q->conditions[k].literal2.type == literal_type_field) {
+                read_field(data, t, i, q->conditions[k].literal2.col);
+                decode_table_field(val2, t, q->conditions[k].literal2.col, data);
+            } else {
+                strcpy(val2, q->conditions[k].literal2.value);
+            }
+
+            // since we only support equals now
+            result = strcmp(val1, val2) == 0;
+        }
+
+        accept = q->conditions[k].conjunction == conjunction_and ? accept && result : accept || result;
+
+    }
+
+    return accept;
+}
+
+// Looks up what row_matches and block_may_match compare each condition with.
+void prepare_conditions(const table *t, const query *q, int *codes, zone_probe *probes) {
+    for (int k = 0; k < q->n_conditions; k++) {
+        const query_condition *c = &q->conditions[k];
+        codes[k] = condition_code(t, c);
+        probes[k].col = -1;
+        if (c->literal1.type == literal_type_field && c->literal2.type == literal_type_constant) {
+            zone_probe_init(&probes[k], t, c->literal1.col, c->literal2.value);
+        }
+    }
+}
+
+// A constant of an equality condition, stored the way its column stores it,
+// for the generated filters of the table's layout.
+typedef struct {
+    int col;
+    bool never;
+    bool and;
+    uint8_t key[MAX_FIELD_LENGTH + 1];
+} codec_key;
+
+// Encodes value for a byte-wise comparison with column col; false when no
+// stored value can decode to it.
+bool encode_codec_key(const table *t, int col, const char *value, uint8_t *key) {
+    const field *f = &t->info.fields[col];
+    if (f->dictionary) {
+        int code = dictionary_find(t->dicts[col], value);
+        uint16_t stored = (uint16_t) code;
+        memcpy(key, &stored, sizeof(stored));
+        return code != -1;
+    }
+
+    encode_value(f, value, key);
+    if (f->type == field_type_integer) {
+        // integers compare as decoded, so only the canonical form can match
+        char canonical[24];
+        int64_t v;
+        memcpy(&v, key, sizeof(v));
+        size_t length = format_int64(canonical, v);
+        return strlen(value) == length && memcmp(value, canonical, length) == 0;
+    }
+    return strlen(value) <= f->length;
+}
+
+// Prepares the conditions of q for codec_filter; false unless t has generated
+// filters and every condition compares one of its columns with a constant.
+bool prepare_codec_keys(const table *t, const query *q, codec_key *keys) {
+    if (t->temporary || t->handle->codec == NULL) {
+        return false;
+    }
+    for (int k = 0; k < q->n_conditions; k++) {
+        const query_condition *c = &q->conditions[k];
+        if (c->literal1.type != literal_type_field || c->literal2.type != literal_type_constant ||
+            c->literal1.table != t || t->handle->codec->filters[c->literal1.col] == NULL) {
+            return false;
+        }
+        keys[k].col = c->literal1.col;
+        keys[k].and = c->conjunction == conjunction_and;
+        keys[k].never = !encode_codec_key(t, c->literal1.col, c->literal2.value, keys[k].key);
+    }
+    return true;
+}
+
+// Evaluates the conditions over n consecutive rows, folding them the way
+// row_matches does.
+void codec_filter(const table *t, const codec_key *keys, int n_keys, const uint8_t *rows, size_t n,
+                  bool *selected) {
+    memset(selected, true, n * sizeof(bool));
+    counters.rows_codec_checked += n;
+    for (int k = 0; k < n_keys; k++) {
+        if (keys[k].never) {
+            if (keys[k].and) {
+                memset(selected, false, n * sizeof(bool));
+            }
+            continue;
+        }
+        t->handle->codec->filters[keys[k].col](rows, n, keys[k].key, selected, keys[k].and);
+        counters.field_bytes_read += n * field_size(t->info.fields[keys[k].col]);
+    }
+}
+
+bool single_query(session *s, query q, query_stats *stats) {
+    table *t = q.tables[0];
+
+    if (t->temporary) {
+        return index_query(s, q, stats);
+    }
+
+    char detail[sizeof(((operator_stats *) 0)->detail)];
+    describe_conditions(detail, sizeof(detail), &q);
+    operator_stats *scan = stats_add(stats, "Scan", detail);
+    describe_fields(detail, sizeof(detail), &q);
+    operator_stats *project = stats_add(stats, "Project", detail);
+
+    size_t matches[SCAN_BATCH];
+    size_t n_out = 0;
+
+    int cols[SELECT_MAX];
+    query_columns(&q, cols);
+    result_writer w;
+    writer_begin(&w, s, &q, t, cols);
+
+    int codes[SELECT_MAX];
+    zone_probe probes[SELECT_MAX];
+    prepare_conditions(t, &q, codes, probes);
+    size_t rows_per_page = t->handle->rows_per_page;
+    size_t checked_block = SIZE_MAX;
+
+    // with generated filters for the table's layout, whole blocks are matched
+    // as the scan enters them
+    codec_key keys[SELECT_MAX];
+    bool *selected = prepare_codec_keys(t, &q, keys) ? malloc(rows_per_page * sizeof(bool)) : NULL;
+
+    // filter a batch of rows, then project its matches, so both operators
+    // can be timed without reading the clock for every row
+    for (size_t start = 0; start < t->info.n_rows;) {
+        size_t end = start + SCAN_BATCH < t->info.n_rows ? start + SCAN_BATCH : t->info.n_rows;
+        size_t n = 0;
+        size_t i;
+
+        stats_resume(scan);
+        for (i = start; i < end; i++) {
+            // consult the zones as the scan enters each block
+            size_t block = i / rows_per_page;
+            if (block != checked_block) {
+                checked_block = block;
+                if (!block_may_match(t, block, &q, probes)) {
+                    counters.blocks_skipped++;
+                    i = (block + 1) * rows_per_page - 1;
+                    continue;
+                }
+                size_t block_end = (block + 1) * rows_per_page;
+                block_end = block_end < t->info.n_rows ? block_end : t->info.n_rows;
+                counters.rows_scanned += block_end - i;
+                if (selected != NULL) {
+                    size_t block_start = block * rows_per_page;
+                    codec_filter(t, keys, q.n_conditions, table_row(t, block_start), block_end - block_start,
+                                 selected);
+                }
+            }
+            if (!row_deleted(t, i) &&
+                (selected != NULL ? selected[i % rows_per_page] : row_matches(t, i, &q, codes))) {
+                matches[n++] = i;
+            }
+        }
+        stats_pause(scan);
+
+        stats_resume(project);
+        for (size_t k = 0; k < n; k++) {
+            writer_row(&w, table_row(t, matches[k]));
+        }
+        stats_pause(project);
+        n_out += n;
+        // a skipped block may end past the batch
+        start = i;
+    }
+
+    free(selected);
+
+    if (scan != NULL) {
+        scan->rows_in = t->info.n_rows;
+        scan->rows_out = n_out;
+    }
+    if (project != NULL) {
+        project->rows_in = n_out;
+        project->rows_out = n_out;
+    }
+
+    stats_resume(project);
+    bool ok = writer_end(&w);
+    stats_pause(project);
+    return ok;
+}
+
+// Like strtok_r, but a token that starts with a double quote runs to the
+// closing quote, so a quoted value may hold the delimiters.
+char *next_token(char **save, const char *delims) {
+    if (*save == NULL) {
+        return NULL;
+    }
+    char *tok = *save + strspn(*save, delims);
+    if (*tok == 0) {
+        *save = tok;
+        return NULL;
+    }
+
+    char *end = tok[0] == '"' ? strchr(tok + 1, '"') : NULL;
+    end = end != NULL ? end + 1 : tok;
+    end += strcspn(end, delims);
+    if (*end != 0) {
+        *end++ = 0;
+    }
+    *save = end;
+    return tok;
+}
+
+void parse_query_literal(literal *lit, const char *op, table *tables[], int n_tables) {
+    lit->type = op[0] == '"' || isdigit(op[0]) ? literal_type_constant : literal_type_field;
+    if (lit->type == literal_type_field) {
+        for (int i = 0; i < n_tables; i++) {
+            int col = table_find_field(tables[i]->info, op);
+            if (col != -1) {
+                lit->table = tables[i];
+                lit->col = col;
+            }
+        }
+    }
+
+    if (lit->type == literal_type_constant && op[0] == '"') {
+        strcpy(lit->value, op + 1);
+        lit->value[strlen(lit->value) - 1] = 0;
+    } else {
+        strcpy(lit->value, op);
+    }
+}
+
+void parse_query_operator(condition_operator *lit, const char *op) {
+    if (strcmp(op, "=") == 0) {
+        *lit = operator_eq;
+    } else {
+        *lit = operator_undefined;
+    }
+}
+
+bool has_self_join(query q) {
+//    for(int i = 0; i < q.n_conditions; i++) {
+//        if(q.conditions[i].literal1.type == literal_type_field && q.conditions[i].literal2.type == literal_type_field) {
+//
+//        }
+//    }
+    return false;
+}
+
+void filter(bool *include, table *t, int col, const char *val) {
+    char field_val[MAX_FIELD_LENGTH];
+    uint8_t data[MAX_FIELD_LENGTH];
+    const field *f = &t->info.fields[col];
+    int code = f->dictionary ? dictionary_find(t->dicts[col], val) : -1;
+    column_filter codec = t->temporary || t->handle->codec == NULL ? NULL : t->handle->codec->filters[col];
+    uint8_t key[MAX_FIELD_LENGTH + 1];
+    bool never = codec != NULL && !encode_codec_key(t, col, val, key);
+
+    zone_probe probe;
+    zone_probe_init(&probe, t, col, val);
+    // an index has no zones; take it as a single block
+    size_t rows_per_page = t->temporary ? t->info.n_rows : t->handle->rows_per_page;
+
+    for (size_t start = 0; start < t->info.n_rows; start += rows_per_page) {
+        size_t end = start + rows_per_page < t->info.n_rows ? start + rows_per_page : t->info.n_rows;
+
+        zone z;
+        if (probe.never || never || (!t->temporary && table_zone(t, start / rows_per_page, col, &z) &&
+                            !zone_may_contain(&z, f, &probe))) {
+            // no row of the block holds the value
+            memset(include + start, false, (end - start) * sizeof(bool));
+            counters.blocks_skipped++;
+            continue;
+        }
+
+        counters.rows_scanned += end - start;
+        if (codec != NULL) {
+            codec(table_row(t, start), end - start, key, include + start, true);
+            counters.rows_codec_checked += end - start;
+            counters.field_bytes_read += (end - start) * field_size(*f);
+            continue;
+        }
+        for (size_t i = start; i < end; i++) {
+            read_field(data, t, i, col);
+            if (f->dictionary) {
+                include[i] &= field_code(data) == code;
+            } else {
+                decode_field(field_val, data, f->type);
+                include[i] &= strcmp(field_val, val) == 0;
+            }
+        }
+    }
+}
+
+void free_result_set(result_set *rs) {
+    count_temp_bytes(0, rs->table->info.n_rows * sizeof(bool));
+    free(rs->include_rows);
+    free(rs);
+}
+
+result_set *create_result_set(table *t) {
+    result_set *rs = malloc(sizeof(result_set));
+    rs->table = t;
+    rs->include_rows = malloc(t->info.n_rows * sizeof(bool));
+    count_temp_bytes(t->info.n_rows * sizeof(bool), 0);
+    for (int i = 0; i < t->info.n_rows * sizeof(bool); ++i) {
+        rs->include_rows[i] = !row_deleted(t, i);
+    }
+    return rs;
+}
+
+result_set *get_result_set(result_set **rs, int rs_size, const table *t) {
+    for (int i = 0; i < rs_size; i++) {
+        if (rs[i]->table == t) {
+            return rs[i];
+        }
+    }
+    fputs("Result set not found", stderr);
+    return NULL;
+}
+
+size_t count_included_rows(size_t n, const bool *array) {
+    size_t x = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (array[i]) {
+            x++;
+        }
+    }
+
+    return x;
+}
+
+bloom_filter *create_bloom_filter(size_t n_keys) {
+    bloom_filter *b = malloc(sizeof(bloom_filter));
+    size_t bits = 1024;
+    while (bits < n_keys * BLOOM_BITS_PER_KEY) {
+        bits *= 2;
+    }
+    b->mask = bits - 1;
+    b->bits = calloc(bits / 64, sizeof(uint64_t));
+    count_temp_bytes(bits / 8, 0);
+    return b;
+}
+
+void free_bloom_filter(bloom_filter *b) {
+    count_temp_bytes(0, (b->mask + 1) / 8);
+    free(b->bits);
+    free(b);
+}
+
+// Sets or tests BLOOM_HASHES bits derived from one hash by double hashing.
+void bloom_add(bloom_filter *b, uint64_t hash) {
+    uint64_t step = (hash >> 32 | hash << 32) | 1;
+    for (int i = 0; i < BLOOM_HASHES; i++, hash += step) {
+        b->bits[(hash & b->mask) / 64] |= (uint64_t) 1 << (hash & 63);
+    }
+}
+
+bool bloom_test(const bloom_filter *b, uint64_t hash) {
+    uint64_t step = (hash >> 32 | hash << 32) | 1;
+    for (int i = 0; i < BLOOM_HASHES; i++, hash += step) {
+        if (!(b->bits[(hash & b->mask) / 64] >> (hash & 63) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Hash of a field's value in the form joins compare it, as a string.
+uint64_t field_value_hash(table *t, size_t row, int col) {
+    uint8_t data[MAX_FIELD_LENGTH];
+    char value[MAX_FIELD_LENGTH];
+    const field *f = &t->info.fields[col];
+    const char *str = value;
+
+    read_field(data, t, row, col);
+    if (f->dictionary) {
+        str = dictionary_value(t->dicts[col], field_code(data));
+    } else if (f->type == field_type_char) {
+        str = (const char *) data;
+    } else {
+        decode_field(value, data, f->type);
+    }
+    return hash_bytes(str, strlen(str));
+}
+
+// Semi-join reduction: drops the included rows of `to` whose key cannot match
+// the key of any included row of `from`, and returns the rows left in `to`.
+size_t semi_join(table *from, int from_col, const bool *from_rows, table *to, int to_col, bool *to_rows) {
+    bloom_filter *b = create_bloom_filter(count_included_rows(from->info.n_rows, from_rows));
+    for (size_t i = 0; i < from->info.n_rows; i++) {
+        if (from_rows[i]) {
+            bloom_add(b, field_value_hash(from, i, from_col));
+        }
+    }
+
+    size_t left = 0;
+    for (size_t i = 0; i < to->info.n_rows; i++) {
+        if (to_rows[i]) {
+            to_rows[i] = bloom_test(b, field_value_hash(to, i, to_col));
+            left += to_rows[i];
+        }
+    }
+
+    free_bloom_filter(b);
+    return left;
+}
+
+// The output of joins as row ids: row r is made of row ids[r * n_tables + k]
+// of tables[k]. Columns are read from the tables only for the join keys and
+// the final projection, so wide rows are never copied through the joins.
+typedef struct {
+    int n_tables;
+    table *tables[SELECT_MAX + 1];
+    size_t n_rows;
+    size_t capacity;
+    size_t *ids;
+} join_result;
+
+// A result of the tables of left (none if NULL) followed by t.
+join_result *create_join_result(const join_result *left, table *t) {
+    join_result *r = calloc(1, sizeof(join_result));
+    if (left != NULL) {
+        memcpy(r->tables, left->tables, left->n_tables * sizeof(table *));
+        r->n_tables = left->n_tables;
+    }
+    r->tables[r->n_tables++] = t;
+    return r;
+}
+
+void free_join_result(join_result *r) {
+    if (r == NULL) {
+        return;
+    }
+    count_temp_bytes(0, r->capacity * r->n_tables * sizeof(size_t));
+    free(r->ids);
+    free(r);
+}
+
+// Appends row i of left (nothing if left is NULL) joined with row id of the
+// last table.
+void append_join_row(join_result *r, const join_result *left, size_t i, size_t id) {
+    if (r->n_rows == r->capacity) {
+        size_t capacity = r->capacity == 0 ? SCAN_BATCH : 2 * r->capacity;
+        r->ids = realloc(r->ids, capacity * r->n_tables * sizeof(size_t));
+        count_temp_bytes(capacity * r->n_tables * sizeof(size_t), r->capacity * r->n_tables * sizeof(size_t));
+        r->capacity = capacity;
+    }
+    size_t *out = r->ids + r->n_rows * r->n_tables;
+    if (left != NULL) {
+        memcpy(out, left->ids + i * left->n_tables, left->n_tables * sizeof(size_t));
+    }
+    out[r->n_tables - 1] = id;
+    r->n_rows++;
+}
+
+join_result *rows_to_join_result(table *t, const bool *include_rows) {
+    join_result *r = create_join_result(NULL, t);
+    for (size_t i = 0; i < t->info.n_rows; i++) {
+        if (include_rows[i]) {
+            append_join_row(r, NULL, 0, i);
+        }
+    }
+    return r;
+}
+
+// Finds a column of the result by name, in the first of its tables that has
+// one, the way fields were found in the concatenated rows.
+bool find_join_field(const join_result *r, const char *name, int *slot, int *col) {
+    for (int k = 0; k < r->n_tables; k++) {
+        *col = table_find_field(r->tables[k]->info, name);
+        if (*col != -1) {
+            *slot = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the field at offset in the row of tables[slot] that row i of the
+// result comes from; valid until the next read of that table.
+const uint8_t *join_result_field(join_result *r, size_t i, int slot, size_t offset) {
+    return table_row(r->tables[slot], r->ids[i * r->n_tables + slot]) + offset;
+}
+
+// The join keys of one input of a nested loop join, read once so the loop
+// compares them without going back to the rows: codes of the right input's
+// dictionary when both columns are dictionary-encoded, else the values as
+// text in slots of width bytes.
+typedef struct {
+    size_t n;
+    size_t capacity;
+    size_t *rows;
+    int *codes;
+    char *values;
+    size_t width;
+} join_keys;
+
+size_t join_key_width(const field *f) {
+    switch (f->type) {
+        case field_type_char:
+            return f->length + 1;
+        case field_type_integer:
+            return sizeof("-9223372036854775808");
+        case field_type_undefined:
+        default:
+            return sizeof("undefined");
+    }
+}
+
+void init_join_keys(join_keys *k, size_t n, bool by_code, size_t width) {
+    k->n = 0;
+    k->capacity = n;
+    k->rows = malloc(n * sizeof(size_t));
+    k->codes = by_code ? malloc(n * sizeof(int)) : NULL;
+    k->values = by_code ? NULL : malloc(n * width);
+    k->width = by_code ? sizeof(int) : width;
+    count_temp_bytes(n * (sizeof(size_t) + k->width), 0);
+}
+
+void free_join_keys(join_keys *k) {
+    count_temp_bytes(0, k->capacity * (sizeof(size_t) + k->width));
+    free(k->rows);
+    free(k->codes);
+    free(k->values);
+}
+
+// Adds the key of a row, raw column col of t; translate maps t's dictionary
+// codes to those of the other input. A value absent from it is left out.
+void add_join_key(join_keys *k, size_t row, const table *t, int col, const uint8_t *raw, const int *translate) {
+    if (k->codes != NULL) {
+        int code = translate != NULL ? translate[field_code(raw)] : field_code(raw);
+        if (code == -1) {
+            return;
+        }
+        k->codes[k->n] = code;
+    } else {
+        decode_table_field(k->values + k->n * k->width, t, col, raw);
+    }
+    k->rows[k->n++] = row;
+}
+
+// When both columns are dictionary-encoded, the codes of a are translated to
+// codes of b once and the join compares codes instead of strings.
+int *join_code_map(const table *table_a, int col_a, const table *table_b, int col_b) {
+    dictionary *dict_a = table_a->info.fields[col_a].dictionary ? table_a->dicts[col_a] : NULL;
+    dictionary *dict_b = table_b->info.fields[col_b].dictionary ? table_b->dicts[col_b] : NULL;
+    if (dict_a == NULL || dict_b == NULL) {
+        return NULL;
+    }
+    size_t n_entries = __atomic_load_n(&dict_a->n_entries, __ATOMIC_ACQUIRE);
+    int *codes = malloc((n_entries + 1) * sizeof(int));
+    for (size_t code = 0; code < n_entries; code++) {
+        codes[code] = dict_a == dict_b ? (int) code : dictionary_find(dict_b, dictionary_value(dict_a, code));
+    }
+    return codes;
+}
+
+// Reads the keys of the rows of t that pass include_rows: the right input of
+// a nested loop join.
+void table_join_keys(join_keys *k, table *t, int col, const bool *include_rows, bool by_code, size_t width) {
+    size_t offset = seek_pos(t->info, 0, col);
+    init_join_keys(k, count_included_rows(t->info.n_rows, include_rows), by_code, width);
+    for (size_t i = 0; i < t->info.n_rows; i++) {
+        if (include_rows[i]) {
+            add_join_key(k, i, t, col, table_row(t, i) + offset, NULL);
+        }
+    }
+}
+
+// Joins every row of left with every right key that equals its column col of
+// tables[slot]. The output keeps the order of left, then of right.
+join_result *nested_loop_join(join_result *left, int slot, int col, table *table_b, const join_keys *right,
+                              const int *codes) {
+    table *table_a = left->tables[slot];
+    size_t offset = seek_pos(table_a->info, 0, col);
+    join_result *r = create_join_result(left, table_b);
+
+    join_keys keys;
+    init_join_keys(&keys, left->n_rows, codes != NULL, right->width);
+    for (size_t i = 0; i < left->n_rows; i++) {
+        add_join_key(&keys, i, table_a, col, join_result_field(left, i, slot, offset), codes);
+    }
+
+    for (size_t i = 0; i < keys.n; i++) {
+        counters.join_comparisons += right->n;
+        if (codes != NULL) {
+            for (size_t j = 0; j < right->n; j++) {
+                if (keys.codes[i] == right->codes[j]) {
+                    append_join_row(r, left, keys.rows[i], right->rows[j]);
+                }
+            }
+        } else {
+            const char *key = keys.values + i * keys.width;
+            for (size_t j = 0; j < right->n; j++) {
+                if (strcmp(key, right->values + j * right->width) == 0) {
+                    append_join_row(r, left, keys.rows[i], right->rows[j]);
+                }
+            }
+        }
+    }
+
+    free_join_keys(&keys);
+    return r;
+}
+
+// Whether the rows of t are in strcmp order of col: an index is sorted on its
+// leading column.
+bool sorted_on(const table *t, int col) {
+    return t->temporary && col == 0 && t->info.fields[0].type == field_type_char && !t->info.fields[0].dictionary;
+}
+
+// Joins a left input and the rows of b that pass include_b, both sorted on
+// their join columns, in one pass over each, using no memory beyond the
+// output. The output keeps the order of left, so it is the same as the
+// nested loop join would produce.
+join_result *merge_join(join_result *left, int slot, int col_a, table *table_b, int col_b, const bool *include_b) {
+    join_result *r = create_join_result(left, table_b);
+    size_t offset_a = seek_pos(left->tables[slot]->info, 0, col_a);
+    size_t offset_b = seek_pos(table_b->info, 0, col_b);
+    size_t n_a = left->n_rows;
+    size_t n_b = table_b->info.n_rows;
+    char key[MAX_FIELD_LENGTH + 1];
+
+    size_t i = 0;
+    size_t j = 0;
+    while (i < n_a && j < n_b) {
+        if (!include_b[j]) {
+            j++;
+            continue;
+        }
+
+        snprintf(key, sizeof(key), "%s", (const char *) join_result_field(left, i, slot, offset_a));
+        int diff = strcmp(key, (const char *) (table_row(table_b, j) + offset_b));
+        counters.join_comparisons++;
+        if (diff < 0) {
+            i++;
+            continue;
+        } else if (diff > 0) {
+            j++;
+            continue;
+        }
+
+        // the rows with this key on either side
+        size_t end_a = i + 1;
+        while (end_a < n_a && strcmp(key, (const char *) join_result_field(left, end_a, slot, offset_a)) == 0) {
+            end_a++;
+        }
+        size_t end_b = j + 1;
+        while (end_b < n_b && strcmp(key, (const char *) (table_row(table_b, end_b) + offset_b)) == 0) {
+            end_b++;
+        }
+        counters.join_comparisons += end_a - i + end_b - j;
+
+        for (; i < end_a; i++) {
+            for (size_t k = j; k < end_b; k++) {
+                if (include_b[k]) {
+                    append_join_row(r, left, i, k);
+                }
+            }
+        }
+        j = end_b;
+    }
+
+    return r;
+}
+
+#ifdef DEBUG
+
+void print_table(table *t) {
+    char text[MAX_FIELD_LENGTH];
+    for (int i = 0; i < t->info.n_rows; i++) {
+        for (int j = 0; j < t->info.n_fields; j++) {
+            decode_temp_table_field(text, t, i, j);
+            printf("%12s ", text);
+        }
+        printf("\n");
+    }
+}
+#endif
+
+bool do_join_query(session *s, query q, const query_plan *plan, query_stats *stats) {
+    int rs_size = q.n_tables;
+    char detail[sizeof(((operator_stats *) 0)->detail)];
+
+    // we ignore outer joins
+
+    result_set **rs_c = alloca(sizeof(result_set *) * q.n_tables);
+    for (int i = 0; i < q.n_tables; i++) {
+        rs_c[i] = create_result_set(q.tables[i]);
+    }
+
+    // run all filters
+    for (int k = 0; k < plan->n_filters; k++) {
+        query_condition *c = &q.conditions[plan->filters[k]];
+        describe_filter(detail, sizeof(detail), c);
+        operator_stats *op = stats_begin(stats, "Filter", detail);
+
+        result_set *rs = get_result_set(rs_c, rs_size, c->literal1.table);
+        filter(rs->include_rows, c->literal1.table, c->literal1.col, c->literal2.value);
+
+        stats_end(op, c->literal1.table->info.n_rows,
+                  count_included_rows(c->literal1.table->info.n_rows, rs->include_rows));
+    }
+
+    // Push bloom filters of join keys both ways across the joins the plan
+    // picked, so the selectivity of each table's filters reaches the others
+    // before the joins read any row ids.
+    for (int n = 0; n < plan->n_semi_joins; n++) {
+        query_condition *c = &q.conditions[plan->semi_joins[n]];
+        table *t1 = c->literal1.table;
+        table *t2 = c->literal2.table;
+
+        describe_condition(detail, sizeof(detail), c);
+        operator_stats *op = stats_begin(stats, "Semi Join", detail);
+
+        result_set *rs1 = get_result_set(rs_c, rs_size, t1);
+        result_set *rs2 = get_result_set(rs_c, rs_size, t2);
+        size_t rows_in = count_included_rows(t1->info.n_rows, rs1->include_rows) +
+                         count_included_rows(t2->info.n_rows, rs2->include_rows);
+        semi_join(t1, c->literal1.col, rs1->include_rows, t2, c->literal2.col, rs2->include_rows);
+        semi_join(t2, c->literal2.col, rs2->include_rows, t1, c->literal1.col, rs1->include_rows);
+        size_t rows_out = count_included_rows(t1->info.n_rows, rs1->include_rows) +
+                          count_included_rows(t2->info.n_rows, rs2->include_rows);
+
+        stats_end(op, rows_in, rows_out);
+    }
+
+    join_result *result = NULL;
+    bool ok = true;
+    for (int k = 0; ok && k < plan->n_joins; k++) {
+        query_condition *c = &q.conditions[plan->joins[k]];
+        table *right = c->literal2.table;
+        bool *right_rows = get_result_set(rs_c, rs_size, right)->include_rows;
+        describe_condition(detail, sizeof(detail), c);
+        operator_stats *op;
+
+        if (result == NULL) {
+            // the first input starts as the ids of its rows
+            table *first = c->literal1.table;
+            op = plan->merge[k] ? NULL : stats_begin(stats, "Materialize", first->info.name);
+            result = rows_to_join_result(first, get_result_set(rs_c, rs_size, first)->include_rows);
+            stats_end(op, first->info.n_rows, result->n_rows);
+        }
+
+        int slot;
+        int col;
+        if (!find_join_field(result, c->literal1.value, &slot, &col)) {
+            ok = false;
+            break;
+        }
+
+        join_result *joined;
+        if (plan->merge[k]) {
+            // both inputs are read in place, in key order
+            size_t rows_in = result->n_rows + count_included_rows(right->info.n_rows, right_rows);
+            op = stats_begin(stats, "Merge Join", detail);
+            joined = merge_join(result, slot, col, right, c->literal2.col, right_rows);
+            stats_end(op, rows_in, joined->n_rows);
+        } else {
+            int *codes = join_code_map(result->tables[slot], col, right, c->literal2.col);
+            size_t width = join_key_width(&result->tables[slot]->info.fields[col]);
+            size_t right_width = join_key_width(&right->info.fields[c->literal2.col]);
+
+            // only the ids and join keys of the right input are read out
+            op = stats_begin(stats, "Materialize", right->info.name);
+            join_keys keys;
+            table_join_keys(&keys, right, c->literal2.col, right_rows, codes != NULL,
+                            width > right_width ? width : right_width);
+            stats_end(op, right->info.n_rows, keys.n);
+
+            op = stats_begin(stats, "Nested Loop Join", detail);
+            joined = nested_loop_join(result, slot, col, right, &keys, codes);
+            stats_end(op, result->n_rows + keys.n, joined->n_rows);
+
+            free_join_keys(&keys);
+            free(codes);
+        }
+
+        free_join_result(result);
+        result = joined;
+    }
+
+    for (int i = 0; i < q.n_tables; i++) {
+        free_result_set(rs_c[i]);
+    }
+
+    if (result == NULL || !ok) {
+        free_join_result(result);
+        return false;
+    }
+
+#ifdef DEBUG
+    printf("Rows: %lu\n", result->n_rows);
+    puts("-------");
+#endif
+
+    describe_fields(detail, sizeof(detail), &q);
+    operator_stats *project = stats_begin(stats, "Project", detail);
+
+    // fetch the projected fields of each row into one row of their own
+    int slots[SELECT_MAX];
+    size_t offsets[SELECT_MAX];
+    int cols[SELECT_MAX];
+    field fields[SELECT_MAX];
+    dictionary *dicts[SELECT_MAX];
+    for (int k = 0; k < q.n_fields; k++) {
+        int col;
+        if (!find_join_field(result, q.fields[k].field, &slots[k], &col)) {
+            stats_end(project, result->n_rows, 0);
+            free_join_result(result);
+            return false;
+        }
+        const table *t = result->tables[slots[k]];
+        offsets[k] = seek_pos(t->info, 0, col);
+        fields[k] = t->info.fields[col];
+        dicts[k] = t->dicts[col];
+        cols[k] = k;
+    }
+    table *row = create_temp_table(q.n_fields, fields, 1);
+    memcpy(row->dicts, dicts, q.n_fields * sizeof(dictionary *));
+
+    result_writer w;
+    writer_begin(&w, s, &q, row, cols);
+    for (size_t i = 0; i < result->n_rows; i++) {
+        for (int k = 0; k < q.n_fields; k++) {
+            size_t size = field_size(fields[k]);
+            memcpy(row->data + w.offsets[k], join_result_field(result, i, slots[k], offsets[k]), size);
+            counters.field_bytes_read += size;
+        }
+        writer_row(&w, row->data);
+    }
+    ok = writer_end(&w);
+
+    stats_end(project, result->n_rows, result->n_rows);
+
+    close_table(row);
+    free_join_result(result);
+    return ok;
+}
+
+// Opens a hash index for queries. A lookup of its key maps its files; other
+// queries load all of it first.
+table *open_hash_table(const char *name) {
+    pthread_rwlock_rdlock(&index_lock);
+    hash_index *ix = open_hash_index(name, O_RDONLY);
+    pthread_rwlock_unlock(&index_lock);
+    if (ix == NULL) {
+        return NULL;
+    }
+    snprintf(ix->name, sizeof(ix->name), "%s", name);
+
+    table *t = malloc(sizeof(table));
+    t->info = ix->header.info;
+    t->info.n_rows = 0;
+    snprintf(t->info.name, sizeof(t->info.name), "%s", name);
+    t->temporary = true;
+    t->handle = NULL;
+    t->page = NULL;
+    t->data = NULL;
+    t->capacity = 0;
+    t->deleted = NULL;
+    memset(t->dicts, 0, sizeof(t->dicts));
+    t->hash = ix;
+    // entries of rows deleted since, or inserted after this, are left out,
+    // and the others are checked against the rows they were made from
+    t->source = open_table(ix->header.info.name);
+    ix->n_cols = ix->header.info.n_fields;
+    for (int j = 0; t->source != NULL && j < ix->n_cols; j++) {
+        ix->cols[j] = table_find_field(t->source->info, ix->header.info.fields[j].name);
+        if (ix->cols[j] == -1) {
+            close_table(t->source);
+            t->source = NULL;
+        }
+    }
+    return t;
+}
+
+table *open_index(const char *name) {
+    char filename[FILENAME_MAX];
+    sprintf(filename, "%s.index", name);
+
+    pthread_rwlock_rdlock(&index_lock);
+    FILE *fp = fopen(filename, "rb");
+    sprintf(filename, "%s.index.bin", name);
+    FILE *data_fp = fp != NULL ? fopen(filename, "rb") : NULL;
+    pthread_rwlock_unlock(&index_lock);
+
+    if (fp == NULL || data_fp == NULL) {
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        return open_hash_table(name);
+    }
+
+    table *t = malloc(sizeof(table));
+    t->temporary = true;
+    t->handle = NULL;
+    t->page = NULL;
+    t->deleted = NULL;
+    t->hash = NULL;
+    t->source = NULL;
+    memset(t->dicts, 0, sizeof(t->dicts));
+    fread(&t->info, sizeof(table_info), 1, fp);
+
+    if (ferror(fp)) {
+        fclose(fp);
+        fclose(data_fp);
+        free(t);
+        return NULL;
+    }
+
+    fclose(fp);
+    fp = data_fp;
+
+    size_t size = row_size(t->info) * t->info.n_rows * sizeof(uint8_t);
+    t->data = malloc(size);
+    t->capacity = size;
+
+    bool ok;
+    if (t->info.compressed) {
+        ok = read_blocks(fp, t->data, size);
+    } else {
+        ok = fread(t->data, size, 1, fp) == 1 || size == 0;
+        counters.bytes_read += size;
+    }
+
+    if (!ok) {
+        fclose(fp);
+        free(t->data);
+        free(t);
+        return NULL;
+    }
+
+    fclose(fp);
+    snprintf(t->info.name, sizeof(t->info.name), "%s", name);
+    count_temp_bytes(size, 0);
+    return t;
+}
+
+void close_query_tables(query *q) {
+    for (int i = 0; i < q->n_tables; i++) {
+        close_table(q->tables[i]);
+    }
+    q->n_tables = 0;
+}
+
+const char *query_path_to_str(query_path path) {
+    switch (path) {
+        case path_single_query:
+            return "single_query";
+        case path_index_query:
+            return "index_query";
+        case path_hash_lookup:
+            return "hash_lookup";
+        case path_join_query:
+            return "do_join_query";
+    }
+    return "undefined";
+}
+
+int query_table_index(const query *q, const table *t) {
+    int k = 0;
+    while (k < q->n_tables - 1 && q->tables[k] != t) {
+        k++;
+    }
+    return k;
+}
+
+void plan_query(query *q, query_plan *plan) {
+    plan->n_filters = 0;
+    plan->n_joins = 0;
+    plan->n_semi_joins = 0;
+
+    if (1 == q->n_tables && !has_self_join(*q)) {
+        const query_condition *c = &q->conditions[0];
+        if (q->tables[0]->hash != NULL && q->n_conditions == 1 && c->literal1.type == literal_type_field &&
+            c->literal1.col == 0 && c->literal2.type == literal_type_constant) {
+            plan->path = path_hash_lookup;
+        } else {
+            plan->path = q->tables[0]->temporary ? path_index_query : path_single_query;
+        }
+        return;
+    }
+
+    plan->path = path_join_query;
+    for (int i = 0; i < q->n_conditions; i++) {
+        if (q->conditions[i].literal2.type == literal_type_field) {
+            plan->joins[plan->n_joins++] = i;
+        } else if (q->conditions[i].literal1.type == literal_type_field) {
+            plan->filters[plan->n_filters++] = i;
+        }
+    }
+
+    // A join merges when both inputs are in key order. Joined rows keep the
+    // order of the left input, and after a merge both keys are in order, so
+    // later joins on those fields can merge too.
+    const char *sorted[2] = {NULL, NULL};
+    for (int k = 0; k < plan->n_joins; k++) {
+        query_condition *c = &q->conditions[plan->joins[k]];
+        bool left_sorted;
+        if (k == 0) {
+            left_sorted = sorted_on(c->literal1.table, c->literal1.col);
+            sorted[0] = left_sorted ? c->literal1.value : NULL;
+        } else {
+            left_sorted = (sorted[0] != NULL && strcmp(sorted[0], c->literal1.value) == 0) ||
+                          (sorted[1] != NULL && strcmp(sorted[1], c->literal1.value) == 0);
+        }
+
+        plan->merge[k] = left_sorted && sorted_on(c->literal2.table, c->literal2.col);
+        if (plan->merge[k]) {
+            sorted[0] = c->literal1.value;
+            sorted[1] = c->literal2.value;
+        }
+    }
+
+    // Semi joins carry the filters of each table to the tables it joins,
+    // forward and then backward over the joins. One runs only when an input
+    // was reduced, by a filter or another semi join, since it last ran:
+    // otherwise it would only drop the rows without a partner, which the
+    // join does anyway.
+    int reduced_at[SELECT_MAX];
+    int ran_at[SELECT_MAX];
+    for (int k = 0; k < q->n_tables; k++) {
+        reduced_at[k] = -1;
+    }
+    for (int k = 0; k < plan->n_joins; k++) {
+        ran_at[k] = -1;
+    }
+    for (int k = 0; k < plan->n_filters; k++) {
+        reduced_at[query_table_index(q, q->conditions[plan->filters[k]].literal1.table)] = 0;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (int n = 0; n < plan->n_joins; n++) {
+            int k = pass == 0 ? n : plan->n_joins - 1 - n;
+            const query_condition *c = &q->conditions[plan->joins[k]];
+            int t1 = query_table_index(q, c->literal1.table);
+            int t2 = query_table_index(q, c->literal2.table);
+            int changed = reduced_at[t1] > reduced_at[t2] ? reduced_at[t1] : reduced_at[t2];
+            if (t1 == t2 || changed <= ran_at[k]) {
+                continue;
+            }
+            ran_at[k] = reduced_at[t1] = reduced_at[t2] = plan->n_semi_joins + 1;
+            plan->semi_joins[plan->n_semi_joins++] = plan->joins[k];
+        }
+    }
+}
+
+// Lists the operators a plan would run, in the order the executors add them.
+void describe_plan(query *q, const query_plan *plan, query_stats *stats) {
+    char detail[sizeof(((operator_stats *) 0)->detail)];
+    char fields[sizeof(detail)];
+    describe_conditions(detail, sizeof(detail), q);
+    describe_fields(fields, sizeof(fields), q);
+
+    switch (plan->path) {
+        case path_single_query:
+            stats_add(stats, "Scan", detail);
+            break;
+        case path_index_query:
+            stats_add(stats, q->n_conditions > 0 ? "Index Search" : "Index Scan", detail);
+            break;
+        case path_hash_lookup:
+            stats_add(stats, "Hash Lookup", detail);
+            break;
+        case path_join_query:
+            for (int k = 0; k < plan->n_filters; k++) {
+                query_condition *c = &q->conditions[plan->filters[k]];
+                describe_filter(detail, sizeof(detail), c);
+                stats_add(stats, "Filter", detail);
+            }
+            for (int n = 0; n < plan->n_semi_joins; n++) {
+                describe_condition(detail, sizeof(detail), &q->conditions[plan->semi_joins[n]]);
+                stats_add(stats, "Semi Join", detail);
+            }
+            for (int k = 0; k < plan->n_joins; k++) {
+                query_condition *c = &q->conditions[plan->joins[k]];
+                describe_condition(detail, sizeof(detail), c);
+                if (plan->merge[k]) {
+                    stats_add(stats, "Merge Join", detail);
+                    continue;
+                }
+                if (k == 0) {
+                    stats_add(stats, "Materialize", c->literal1.table->info.name);
+                }
+                stats_add(stats, "Materialize", c->literal2.table->info.name);
+                stats_add(stats, "Nested Loop Join", detail);
+            }
+            break;
+    }
+    stats_add(stats, "Project", fields);
+}
+
+bool execute_query(session *s, query *q, const query_plan *plan, query_stats *stats) {
+    size_t temp_bytes = counters.temp_bytes;
+    counters.peak_temp_bytes = temp_bytes;
+    double started = now();
+
+    // anything but a lookup reads a hash index like a sorted one
+    for (int i = 0; plan->path != path_hash_lookup && i < q->n_tables; i++) {
+        load_hash_table(q->tables[i]);
+    }
+
+    bool ok = false;
+    switch (plan->path) {
+        case path_single_query:
+            ok = single_query(s, *q, stats);
+            break;
+        case path_index_query:
+            ok = index_query(s, *q, stats);
+            break;
+        case path_hash_lookup:
+            ok = hash_query(s, *q, stats);
+            break;
+        case path_join_query:
+            ok = do_join_query(s, *q, plan, stats);
+            break;
+    }
+
+    stats->seconds = now() - started;
+    stats->rows = stats->n_ops > 0 ? stats->ops[stats->n_ops - 1].rows_out : 0;
+    stats->peak_temp_bytes = counters.peak_temp_bytes - temp_bytes;
+    return ok;
+}
+
+void print_query_stats(FILE *out, const query_stats *stats, bool analyzed) {
+    fprintf(out, "Plan: %s\n", query_path_to_str(stats->path));
+    if (!analyzed) {
+        for (int i = 0; i < stats->n_ops; i++) {
+            fprintf(out, "%-18s %s\n", stats->ops[i].name, stats->ops[i].detail);
+        }
+        return;
+    }
+
+    fprintf(out, "%-18s %10s %10s %10s %12s %10s %10s %10s %12s  %s\n", "Operator", "Time ms", "Rows in",
+            "Rows out", "Bytes read", "Page reads", "Cache hits", "Skipped", "Temp bytes", "Detail");
+    for (int i = 0; i < stats->n_ops; i++) {
+        const operator_stats *op = &stats->ops[i];
+        fprintf(out, "%-18s %10.3f %10zu %10zu %12zu %10zu %10zu %10zu %12zu  %s\n", op->name, op->seconds * 1000,
+                op->rows_in, op->rows_out, op->io.bytes_read, op->io.page_reads, op->io.page_hits,
+                op->io.blocks_skipped, op->io.temp_bytes, op->detail);
+    }
+    fprintf(out, "Total: %.3f ms, %zu rows, peak temp memory %zu bytes\n", stats->seconds * 1000, stats->rows,
+            stats->peak_temp_bytes);
+}
+
+void print_json_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// One JSON object on a single line; statement is included when not NULL.
+void print_query_stats_json(FILE *out, const query_stats *stats, bool analyzed, const char *statement) {
+    fputc('{', out);
+    if (statement != NULL) {
+        fputs("\"statement\":", out);
+        print_json_string(out, statement);
+        fputc(',', out);
+    }
+    fprintf(out, "\"plan\":\"%s\"", query_path_to_str(stats->path));
+    if (analyzed) {
+        fprintf(out, ",\"time_ms\":%.3f,\"rows\":%zu,\"peak_temp_bytes\":%zu", stats->seconds * 1000, stats->rows,
+                stats->peak_temp_bytes);
+    }
+    fputs(",\"operators\":[", out);
+    for (int i = 0; i < stats->n_ops; i++) {
+        const operator_stats *op = &stats->ops[i];
+        fprintf(out, "%s{\"operator\":", i == 0 ? "" : ",");
+        print_json_string(out, op->name);
+        fputs(",\"detail\":", out);
+        print_json_string(out, op->detail);
+        if (analyzed) {
+            fprintf(out, ",\"time_ms\":%.3f,\"rows_in\":%zu,\"rows_out\":%zu,\"bytes_read\":%zu,"
+                         "\"page_reads\":%zu,\"cache_hits\":%zu,\"blocks_skipped\":%zu,\"temp_bytes\":%zu",
+                    op->seconds * 1000, op->rows_in, op->rows_out, op->io.bytes_read, op->io.page_reads,
+                    op->io.page_hits, op->io.blocks_skipped, op->io.temp_bytes);
+        }
+        fputc('}', out);
+    }
+    fputs("]}\n", out);
+}
+
+void log_query_stats(const query_stats *stats, const char *statement) {
+    if (stats_log.fp == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&stats_log.lock);
+    print_query_stats_json(stats_log.fp, stats, true, statement);
+    fflush(stats_log.fp);
+    pthread_mutex_unlock(&stats_log.lock);
+}
+
+bool parse_select(session *s, const char *input, explain_mode mode, bool json) {
+    // parse select fields
+    char buf[INPUT_BUFFER_SIZE];
+
+    query q;
+    q.n_fields = 0;
+    q.n_tables = 0;
+    q.n_conditions = 0;
+
+    char fields[SELECT_MAX][MAX_FIELD_NAME_SIZE] = {0};
+    session result = *s;
+    bool valid = true;
+
+    if (sscanf(input, "SELECT %[^\n]%*c", buf) == 1) {
+
+        char *save = NULL;
+        char *tok = strtok_r(buf, ",", &save);
+        while (tok != NULL && q.n_fields < SELECT_MAX) {
+            strcpy(fields[q.n_fields++], str_trim(tok));
+            tok = strtok_r(NULL, ",", &save);
+        }
+
+//#ifdef DEBUG
+//        for (int i = 0; i < q.n_fields; i++) {
+//            printf("F: %s \n", fields[i]);
+//        }
+//#endif
+
+        do {
+            if (fgets(buf, INPUT_BUFFER_SIZE, s->in) == NULL) {
+                break;
+            }
+            str_trim(buf);
+
+#ifndef QUIET
+            printf("===> %s\n", buf);
+#endif
+
+
+            if (starts_with("FROM", buf)) {
+                strtok_r(buf, " ", &save);
+                while ((tok = strtok_r(NULL, ",", &save)) && q.n_tables < SELECT_MAX) {
+                    //strcpy(q.tables[q.n_tables++], str_trim(tok));
+                    char *name = str_trim(tok);
+                    table *t = open_table(name);
+                    if (t == NULL) {
+                        t = open_index(name);
+                    }
+                    if (NULL != t) {
+                        q.tables[q.n_tables++] = t;
+                    } else {
+                        fputs("Table does not exist", stderr);
+                        close_query_tables(&q);
+                        return false;
+                    }
+                }
+
+            } else if ((starts_with("WHERE", buf) || starts_with("AND", buf) || starts_with("OR", buf)) &&
+                       q.n_conditions < SELECT_MAX) {
+                save = buf;
+                char *conj = next_token(&save, " ");
+                char *op1 = next_token(&save, " ");
+                char *operator = next_token(&save, " ");
+                char *op2 = next_token(&save, " ");
+                if (op2 == NULL || strlen(op1) >= MAX_FIELD_LENGTH || strlen(op2) >= MAX_FIELD_LENGTH) {
+                    valid = false;
+                    continue;
+                }
+                int index = q.n_conditions;
+
+                parse_query_literal(&q.conditions[index].literal1, op1, q.tables, q.n_tables);
+                parse_query_literal(&q.conditions[index].literal2, op2, q.tables, q.n_tables);
+                parse_query_operator(&q.conditions[index].operator, operator);
+
+                if (q.conditions[index].literal1.type == literal_type_constant &&
+                    q.conditions[index].literal2.type == literal_type_field) {
+                    literal temp = q.conditions[index].literal1;
+                    q.conditions[index].literal1 = q.conditions[index].literal2;
+                    q.conditions[index].literal2 = temp;
+                }
+
+                if (strcmp(conj, "WHERE") == 0 || strcmp(conj, "AND") == 0) {
+                    q.conditions[index].conjunction = conjunction_and;
+                } else if (strcmp(conj, "OR") == 0) {
+                    q.conditions[index].conjunction = conjunction_or;
+                }
+                q.n_conditions++;
+            } else if (starts_with("FORMAT", buf)) {
+                if (strcmp(buf, "FORMAT BINARY") == 0) {
+                    result.format = output_binary;
+                } else if (strcmp(buf, "FORMAT TEXT") == 0) {
+                    result.format = output_text;
+                } else {
+                    valid = false;
+                }
+            } else if (starts_with("END", buf)) {
+                break;
+            }
+
+        } while (!feof(s->in));
+
+        // normalize field names
+        for (int i = 0; i < q.n_fields; i++) {
+            bool found = false;
+            for (int j = 0; j < q.n_tables; j++) {
+                int col = table_find_field(q.tables[j]->info, fields[i]);
+                if (col != -1) {
+                    strcpy(q.fields[i].table, q.tables[j]->info.name);
+                    strcpy(q.fields[i].field, fields[i]);
+                    q.fields[i].col = col;
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found) {
+                close_query_tables(&q);
+                return false;
+            }
+        }
+
+        if (!valid) {
+            close_query_tables(&q);
+            return false;
+        }
+
+        if (0 == q.n_tables) {
+            return false;
+        }
+
+        query_plan plan;
+        plan_query(&q, &plan);
+
+        query_stats *stats = malloc(sizeof(query_stats));
+        stats->path = plan.path;
+        stats->n_ops = 0;
+
+        bool ok = true;
+        if (mode == explain_plan) {
+            describe_plan(&q, &plan, stats);
+        } else if (mode == explain_analyze) {
+            // run the query for its statistics only; its rows are discarded
+            FILE *sink = fopen("/dev/null", "w");
+            session discard = {.in = s->in, .out = sink, .format = result.format};
+            ok = sink != NULL && execute_query(&discard, &q, &plan, stats);
+            if (sink != NULL) {
+                fclose(sink);
+            }
+        } else {
+            ok = execute_query(&result, &q, &plan, stats);
+            char statement[INPUT_BUFFER_SIZE];
+            snprintf(statement, sizeof(statement), "%s", input);
+            log_query_stats(stats, str_trim(statement));
+        }
+        close_query_tables(&q);
+
+        if (ok && mode != explain_none) {
+            if (json) {
+                print_query_stats_json(s->out, stats, mode == explain_analyze, NULL);
+            } else {
+                print_query_stats(s->out, stats, mode == explain_analyze);
+            }
+        }
+        free(stats);
+        return ok;
+    }
+
+    return false;
+}
+
+void parse_drop(const char *input) {
+    puts("DROP");
+}
+
+bool show_table_info(session *s, const table_info t) {
+    fprintf(s->out, "Table: %s\n", t.name);
+    fprintf(s->out, "Row size: %lu\n", row_size(t));
+    for (int i = 0; i < t.n_fields; i++) {
+        fprintf(s->out, "%s\t%s(%lu)%s\n", t.fields[i].name, field_type_to_str(t.fields[i].type),
+                t.fields[i].length, t.fields[i].dictionary ? " DICTIONARY" : "");
+    }
+    return true;
+}
+
+bool show_table(session *s, const char *table_name) {
+    table *t = open_table(table_name);
+    if (t != NULL) {
+        bool ok = show_table_info(s, t->info);
+        close_table(t);
+        return ok;
+    }
+    return false;
+}
+
+bool parse_show_table(session *s, const char *input) {
+    char table_name[MAX_TABLE_NAME_SIZE];
+    int n = sscanf(input, "SHOW %s", table_name);
+    if (n != 1) {
+        return false;
+    }
+
+    return show_table(s, table_name);
+}
+
+// Writes an index of the rows a view sees. The header keeps the name of the
+// table in place of the index's own, so VACUUM can find the table's indexes.
+bool build_index(const char *index_name, table *t, const int *cols, int n_cols) {
+    field fields[MAX_TABLE_FIELDS];
+    for (int j = 0; j < n_cols; j++) {
+        fields[j] = t->info.fields[cols[j]];
+        // indexes hold the values themselves, sorted as strings
+        fields[j].dictionary = false;
+    }
+
+    table *tmp = create_temp_table(n_cols, fields, t->info.n_rows);
+    uint8_t value[MAX_FIELD_LENGTH];
+    for (size_t i = 0; i < t->info.n_rows; i++) {
+        if (row_deleted(t, i)) {
+            continue;
+        }
+        for (int j = 0; j < n_cols; j++) {
+            read_field(value, t, i, cols[j]);
+            if (t->info.fields[cols[j]].dictionary) {
+                const char *decoded = dictionary_value(t->dicts[cols[j]], field_code(value));
+                memset(value, 0, field_size(fields[j]));
+                strcpy((char *) value, decoded);
+            }
+            set_temp_table_field(tmp, tmp->info.n_rows, j, value);
+        }
+        tmp->info.n_rows++;
+    }
+
+    qsort(tmp->data, tmp->info.n_rows, row_size(tmp->info), strcmp_wrapper);
+    strcpy(tmp->info.name, t->info.name);
+
+    char filename[FILENAME_MAX];
+    char tmp_name[FILENAME_MAX];
+    sprintf(tmp_name, "%s.index.tmp", index_name);
+    FILE *fp = fopen(tmp_name, "wb");
+    if (fp == NULL) {
+        close_table(tmp);
+        return false;
+    }
+    tmp->info.compressed = true;
+    fwrite(&tmp->info, sizeof(table_info), 1, fp);
+    fclose(fp);
+
+    sprintf(tmp_name, "%s.index.bin.tmp", index_name);
+    fp = fopen(tmp_name, "wb");
+    if (fp == NULL) {
+        close_table(tmp);
+        return false;
+    }
+    bool ok = write_blocks(fp, tmp->data, row_size(tmp->info) * tmp->info.n_rows * sizeof(uint8_t));
+    if (fclose(fp) != 0 || !ok) {
+        unlink(tmp_name);
+        close_table(tmp);
+        return false;
+    }
+
+    pthread_rwlock_wrlock(&index_lock);
+    sprintf(filename, "%s.index.bin", index_name);
+    rename(tmp_name, filename);
+    sprintf(tmp_name, "%s.index.tmp", index_name);
+    sprintf(filename, "%s.index", index_name);
+    rename(tmp_name, filename);
+    // replaces a hash index of the same name
+    remove_hash_index(index_name);
+    ok = add_table_index(t->info.name, index_name);
+    pthread_rwlock_unlock(&index_lock);
+
+#ifdef DEBUG
+    print_table(tmp);
+#endif
+
+    close_table(tmp);
+
+    return ok;
+}
+
+// Builds a hash index of the live rows of a table and hands it to the table's
+// handle, so that inserts from now on add to it. Holds the append lock so no
+// row goes missing in between.
+bool build_hash_index(const char *index_name, const char *table_name, const int *cols, int n_cols) {
+    table *t = open_table_for_write(table_name, false);
+    if (t == NULL) {
+        return false;
+    }
+    table_handle *h = t->handle;
+    pthread_mutex_lock(&h->append_lock);
+    refresh_view(t);
+
+    char prefix[MAX_TABLE_NAME_SIZE + 8];
+    sprintf(prefix, "%s.tmp", index_name);
+    hash_index *ix = create_hash_index(prefix, index_name, &t->info, cols, n_cols);
+    bool ok = ix != NULL;
+    uint8_t *entry = ok ? malloc(ix->entry_size) : NULL;
+    for (size_t i = 0; ok && i < t->info.n_rows; i++) {
+        if (!row_deleted(t, i)) {
+            hash_entry(ix, &t->info, t->dicts, table_row(t, i), i, entry);
+            ok = hash_insert(ix, entry);
+        }
+    }
+    free(entry);
+
+    if (ok) {
+        char fname[FILENAME_MAX];
+        pthread_rwlock_wrlock(&index_lock);
+        ok = rename_hash_index(prefix, index_name);
+        // a sorted index of the same name would be opened first
+        sprintf(fname, "%s.index", index_name);
+        unlink(fname);
+        sprintf(fname, "%s.index.bin", index_name);
+        unlink(fname);
+        ok = ok && add_table_index(table_name, index_name);
+        pthread_rwlock_unlock(&index_lock);
+    }
+
+    if (ok) {
+        for (hash_index **ip = &h->hash_indexes; *ip != NULL; ip = &(*ip)->next) {
+            if (strcmp((*ip)->name, index_name) == 0) {
+                hash_index *old = *ip;
+                *ip = old->next;
+                close_hash_index(old);
+                break;
+            }
+        }
+        ix->next = h->hash_indexes;
+        h->hash_indexes = ix;
+    } else if (ix != NULL) {
+        remove_hash_index(prefix);
+        close_hash_index(ix);
+    }
+
+    pthread_mutex_unlock(&h->append_lock);
+    pthread_rwlock_unlock(&h->schema_lock);
+    close_table(t);
+    return ok;
+}
+
+// CREATE INDEX index USING [HASH] field[, field ...]
+// FROM table
+// END
+bool parse_create_index(session *s, const char *input) {
+    char table_name[MAX_TABLE_NAME_SIZE];
+    char field_names[INPUT_BUFFER_SIZE];
+    char index_name[MAX_TABLE_NAME_SIZE];
+    char buf[INPUT_BUFFER_SIZE];
+
+    int n = sscanf(input, "CREATE INDEX %s USING %[^\n]%*c", index_name, field_names);
+    if (n != 2) {
+        return false;
+    }
+    char *names = field_names;
+    bool hash = starts_with("HASH ", names);
+    if (hash) {
+        names += strlen("HASH ");
+    }
+    if (fgets(buf, INPUT_BUFFER_SIZE, s->in) == NULL) {
+        return false;
+    }
+    n = sscanf(str_trim(buf), "FROM %s", table_name);
+    if (n != 1) {
+        return false;
+    }
+#ifndef QUIET
+    printf("===> %s\n",buf);
+#endif
+    if (fgets(buf, INPUT_BUFFER_SIZE, s->in) == NULL) {
+        buf[0] = 0;
+    }
+    if (strcmp("END", str_trim(buf)) != 0) {
+        fprintf(stderr, "Unknown command: %s\n", buf);
+    }
+#ifndef QUIET
+    printf("===> %s\n",buf);
+#endif
+    table *t = open_table(table_name);
+
+    if (t == NULL) {
+        fputs("Table not found", stderr);
+        return false;
+    }
+
+    int cols[MAX_TABLE_FIELDS];
+    int n_cols = 0;
+    char *save = NULL;
+    char *tok = strtok_r(names, ",", &save);
+    while (tok != NULL) {
+        int col = table_find_field(t->info, str_trim(tok));
+        if (col != -1 && n_cols < MAX_TABLE_FIELDS) {
+            cols[n_cols++] = col;
+        } else {
+            close_table(t);
+            return false;
+        }
+        tok = strtok_r(NULL, ",", &save);
+    }
+
+    if (hash) {
+        close_table(t);
+        return n_cols > 0 && build_hash_index(index_name, table_name, cols, n_cols);
+    }
+
+    bool ok = build_index(index_name, t, cols, n_cols);
+    close_table(t);
+    return ok;
+}
+
+// Collects the live rows of a table that match the conditions of q, skipping
+// the blocks the zones rule out.
+size_t match_rows(table *t, const query *q, size_t **rows) {
+    int codes[SELECT_MAX];
+    zone_probe probes[SELECT_MAX];
+    prepare_conditions(t, q, codes, probes);
+
+    size_t n = 0;
+    size_t capacity = 0;
+    size_t rows_per_page = t->handle->rows_per_page;
+    *rows = NULL;
+
+    for (size_t start = 0; start < t->info.n_rows; start += rows_per_page) {
+        if (!block_may_match(t, start / rows_per_page, q, probes)) {
+            counters.blocks_skipped++;
+            continue;
+        }
+        size_t end = start + rows_per_page < t->info.n_rows ? start + rows_per_page : t->info.n_rows;
+        counters.rows_scanned += end - start;
+        for (size_t i = start; i < end; i++) {
+            if (row_deleted(t, i) || !row_matches(t, i, q, codes)) {
+                continue;
+            }
+            if (n == capacity) {
+                capacity = capacity == 0 ? 64 : 2 * capacity;
+                *rows = realloc(*rows, capacity * sizeof(size_t));
+            }
+            (*rows)[n++] = i;
+        }
+    }
+    return n;
+}
+
+// Reads "WHERE field = value [AND|OR field = value ...]" from the rest of a
+// DELETE or UPDATE line, starting at tok, into the conditions of q.
+bool parse_where(query *q, char *tok, char **save) {
+    if (tok == NULL) {
+        return true;
+    }
+    if (strcmp(tok, "WHERE") != 0) {
+        return false;
+    }
+
+    conjunction conj = conjunction_and;
+    while (q->n_conditions < SELECT_MAX) {
+        char *op1 = next_token(save, " ");
+        char *operator = next_token(save, " ");
+        char *op2 = next_token(save, " ");
+        if (op2 == NULL || strlen(op1) >= MAX_FIELD_LENGTH || strlen(op2) >= MAX_FIELD_LENGTH) {
+            return false;
+        }
+
+        query_condition *c = &q->conditions[q->n_conditions++];
+        c->literal1.col = -1;
+        c->literal2.col = -1;
+        parse_query_literal(&c->literal1, op1, q->tables, q->n_tables);
+        parse_query_literal(&c->literal2, op2, q->tables, q->n_tables);
+        parse_query_operator(&c->operator, operator);
+        c->conjunction = conj;
+
+        if (c->literal1.type == literal_type_constant && c->literal2.type == literal_type_field) {
+            literal temp = c->literal1;
+            c->literal1 = c->literal2;
+            c->literal2 = temp;
+        }
+        if ((c->literal1.type == literal_type_field && c->literal1.col == -1) ||
+            (c->literal2.type == literal_type_field && c->literal2.col == -1) || c->operator != operator_eq) {
+            return false;
+        }
+
+        tok = next_token(save, " ");
+        if (tok == NULL) {
+            return true;
+        } else if (strcmp(tok, "AND") == 0) {
+            conj = conjunction_and;
+        } else if (strcmp(tok, "OR") == 0) {
+            conj = conjunction_or;
+        } else {
+            return false;
+        }
+    }
+    return false;
+}
+
+// DELETE FROM table [WHERE field = value [AND|OR field = value ...]]
+bool parse_delete(const char *input) {
+    char buf[INPUT_BUFFER_SIZE];
+    snprintf(buf, sizeof(buf), "%s", input);
+
+    char *save = NULL;
+    strtok_r(buf, " ", &save);
+    char *from = strtok_r(NULL, " ", &save);
+    char *name = strtok_r(NULL, " ", &save);
+    if (from == NULL || strcmp(from, "FROM") != 0 || name == NULL) {
+        return false;
+    }
+
+    table *t = open_table_for_write(name, false);
+    if (t == NULL) {
+        return false;
+    }
+    table_handle *h = t->handle;
+
+    query q;
+    q.n_tables = 1;
+    q.n_fields = 0;
+    q.n_conditions = 0;
+    q.tables[0] = t;
+    bool ok = parse_where(&q, strtok_r(NULL, " ", &save), &save);
+    if (!ok) {
+        fprintf(stderr, "Invalid DELETE: %s\n", input);
+    }
+
+    // matching under the append lock sees the rows other writers changed
+    // before us, and none that they change meanwhile
+    pthread_mutex_lock(&h->append_lock);
+    size_t *rows = NULL;
+    size_t n = 0;
+    if (ok) {
+        refresh_view(t);
+        n = match_rows(t, &q, &rows);
+    }
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = delete_row(h, rows[i]);
+        counters.rows_deleted += ok;
+    }
+    pthread_mutex_unlock(&h->append_lock);
+    pthread_rwlock_unlock(&h->schema_lock);
+
+    free(rows);
+    close_table(t);
+    return ok;
+}
+
+// UPDATE table SET field = value[, field = value ...] [WHERE ...]
+bool parse_update(const char *input) {
+    char buf[INPUT_BUFFER_SIZE];
+    snprintf(buf, sizeof(buf), "%s", input);
+
+    char *save = NULL;
+    strtok_r(buf, " ", &save);
+    char *name = strtok_r(NULL, " ", &save);
+    char *set = strtok_r(NULL, " ", &save);
+    if (name == NULL || set == NULL || strcmp(set, "SET") != 0) {
+        return false;
+    }
+
+    table *t = open_table_for_write(name, false);
+    if (t == NULL) {
+        return false;
+    }
+    table_handle *h = t->handle;
+
+    query q;
+    q.n_tables = 1;
+    q.n_fields = 0;
+    q.n_conditions = 0;
+    q.tables[0] = t;
+
+    int cols[MAX_TABLE_FIELDS];
+    literal values[MAX_TABLE_FIELDS];
+    int n_cols = 0;
+    bool ok = true;
+    // values are quoted like the constants of WHERE; commas separate the
+    // assignments only outside quotes
+    char *tok = next_token(&save, " ,");
+    while (ok && tok != NULL && strcmp(tok, "WHERE") != 0) {
+        char *operator = next_token(&save, " ,");
+        char *value = next_token(&save, " ,");
+        ok = n_cols < MAX_TABLE_FIELDS && value != NULL && strcmp(operator, "=") == 0 &&
+             strlen(value) < MAX_FIELD_LENGTH && (cols[n_cols] = table_find_field(t->info, tok)) != -1;
+        if (ok) {
+            parse_query_literal(&values[n_cols], value, q.tables, 0);
+            ok = values[n_cols++].type == literal_type_constant;
+        }
+        tok = next_token(&save, " ,");
+    }
+    ok = ok && n_cols > 0 && parse_where(&q, tok, &save);
+    if (!ok) {
+        fprintf(stderr, "Invalid UPDATE: %s\n", input);
+    }
+
+    pthread_mutex_lock(&h->append_lock);
+    size_t *rows = NULL;
+    size_t n = 0;
+    if (ok) {
+        refresh_view(t);
+        n = match_rows(t, &q, &rows);
+    }
+
+    // the new version of a row is appended before the old one is deleted,
+    // so an interrupted update leaves both rather than neither
+    uint8_t *encoded = calloc(h->row_size, 1);
+    uint8_t *row = malloc(h->row_size);
+    for (int j = 0; ok && n > 0 && j < n_cols; j++) {
+        ok = encode_field(h, cols[j], values[j].value, encoded + seek_pos(h->info, 0, cols[j]));
+    }
+    for (size_t i = 0; ok && i < n; i++) {
+        memcpy(row, table_row(t, rows[i]), h->row_size);
+        for (int j = 0; j < n_cols; j++) {
+            size_t pos = seek_pos(h->info, 0, cols[j]);
+            memcpy(row + pos, encoded + pos, field_size(h->info.fields[cols[j]]));
+        }
+        ok = append_row(h, row) && delete_row(h, rows[i]);
+        counters.rows_updated += ok;
+        if (!ok) {
+            fprintf(stderr, "Error updating row %zu of %s\n", rows[i], h->info.name);
+        }
+    }
+    pthread_mutex_unlock(&h->append_lock);
+    pthread_rwlock_unlock(&h->schema_lock);
+
+    free(encoded);
+    free(row);
+    free(rows);
+    close_table(t);
+    return ok;
+}
+
+// Rebuilds the indexes built from a table, which still hold the values of
+// the rows deleted since.
+bool rebuild_indexes(const char *table_name) {
+    char names[MAX_TABLE_INDEXES][MAX_TABLE_NAME_SIZE];
+    int n = read_table_indexes(table_name, names, MAX_TABLE_INDEXES);
+
+    bool ok = true;
+    for (int i = 0; ok && i < n; i++) {
+        char fname[FILENAME_MAX];
+        snprintf(fname, sizeof(fname), "%s.index", names[i]);
+        table_info info;
+        FILE *fp = fopen(fname, "rb");
+        bool found = fp != NULL && fread(&info, sizeof(info), 1, fp) == 1 && strcmp(info.name, table_name) == 0;
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        if (!found) {
+            continue;
+        }
+
+        table *t = open_table(table_name);
+        if (t == NULL) {
+            ok = false;
+            break;
+        }
+        int cols[MAX_TABLE_FIELDS];
+        int n_cols = 0;
+        for (int j = 0; j < info.n_fields; j++) {
+            int col = table_find_field(t->info, info.fields[j].name);
+            if (col != -1) {
+                cols[n_cols++] = col;
+            }
+        }
+        ok &= n_cols == info.n_fields && build_index(names[i], t, cols, n_cols);
+        close_table(t);
+    }
+    return ok;
+}
+
+// VACUUM table
+//
+// Copies the live rows into new files and renames them over the table's.
+// Writers wait on the schema lock meanwhile; readers go on with the old
+// handle, which keeps its files open, and later ones load the new files.
+bool parse_vacuum(const char *input) {
+    char table_name[MAX_TABLE_NAME_SIZE];
+    if (sscanf(input, "VACUUM %31s", table_name) != 1) {
+        return false;
+    }
+
+    table *t = open_table_for_write(table_name, true);
+    if (t == NULL) {
+        return false;
+    }
+    table_handle *h = t->handle;
+    refresh_view(t);
+
+    if (t->deleted == NULL) {
+        pthread_rwlock_unlock(&h->schema_lock);
+        close_table(t);
+        return true;
+    }
+
+    // files left by an interrupted VACUUM went when the table was opened
+    char prefix[MAX_TABLE_NAME_SIZE + 8];
+    sprintf(prefix, "%s.vacuum", table_name);
+
+    table_handle *copy = open_table_handle(&h->info, prefix);
+    bool ok = copy != NULL;
+    if (ok) {
+        pthread_mutex_lock(&catalog.lock);
+        copy->id = catalog.next_id++;
+        pthread_mutex_unlock(&catalog.lock);
+    }
+
+    // hash indexes hold row ids, which change: they are rebuilt alongside
+    hash_index *rebuilt[MAX_TABLE_FIELDS];
+    int n_rebuilt = 0;
+    size_t entry_size = 0;
+    for (hash_index *ix = h->hash_indexes; ok && ix != NULL && n_rebuilt < MAX_TABLE_FIELDS; ix = ix->next) {
+        char ix_prefix[MAX_TABLE_NAME_SIZE + 8];
+        sprintf(ix_prefix, "%s.vacuum", ix->name);
+        rebuilt[n_rebuilt] = create_hash_index(ix_prefix, ix->name, &h->info, ix->cols, ix->n_cols);
+        ok = rebuilt[n_rebuilt] != NULL;
+        if (ok && rebuilt[n_rebuilt]->entry_size > entry_size) {
+            entry_size = rebuilt[n_rebuilt]->entry_size;
+        }
+        n_rebuilt++;
+    }
+
+    // dictionaries are rebuilt with only the values of live rows
+    uint8_t *row = malloc(h->row_size);
+    uint8_t *entry = malloc(entry_size + 1);
+    for (size_t i = 0; ok && i < t->info.n_rows; i++) {
+        if (row_deleted(t, i)) {
+            continue;
+        }
+        memcpy(row, table_row(t, i), h->row_size);
+        for (int k = 0; ok && k < n_rebuilt; k++) {
+            hash_entry(rebuilt[k], &h->info, t->dicts, row, copy->committed_rows, entry);
+            ok = hash_insert(rebuilt[k], entry);
+        }
+        for (int j = 0; ok && j < h->info.n_fields; j++) {
+            if (h->info.fields[j].dictionary) {
+                uint8_t *raw = row + seek_pos(h->info, 0, j);
+                ok = dictionary_encode(copy, j, dictionary_value(t->dicts[j], field_code(raw)), raw);
+            }
+        }
+        ok = ok && append_row(copy, row);
+    }
+    free(row);
+    free(entry);
+    if (copy != NULL) {
+        free_table_handle(copy);
+    }
+
+    // the marker is the commit point: from then on, the table opens with the
+    // compacted files even if moving them into place is cut short
+    bool committed = false;
+    bool unlinked = false;
+    char marker[FILENAME_MAX];
+    sprintf(marker, "%s.commit", prefix);
+    pthread_mutex_lock(&catalog.lock);
+    if (ok) {
+        int fd = open(marker, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        committed = fd != -1 && close(fd) == 0;
+    }
+    ok = committed && finish_vacuum(table_name);
+    for (table_handle **hp = &catalog.handles; committed && *hp != NULL; hp = &(*hp)->next) {
+        if (*hp == h) {
+            *hp = h->next;
+            unlinked = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&catalog.lock);
+
+    for (int k = 0; k < n_rebuilt; k++) {
+        if (rebuilt[k] != NULL) {
+            close_hash_index(rebuilt[k]);
+        }
+    }
+    if (!committed) {
+        // drops the compacted files
+        pthread_mutex_lock(&catalog.lock);
+        finish_vacuum(table_name);
+        pthread_mutex_unlock(&catalog.lock);
+    }
+    h->dropped = committed;
+    pthread_rwlock_unlock(&h->schema_lock);
+    if (unlinked) {
+        catalog_release(h);
+    }
+    close_table(t);
+
+    return ok && rebuild_indexes(table_name);
+}
+
+// EXPLAIN [ANALYZE] [JSON] SELECT ...
+bool parse_explain(session *s, const char *input) {
+    explain_mode mode = explain_plan;
+    bool json = false;
+
+    input += strlen("EXPLAIN");
+    while (isspace((unsigned char) *input)) {
+        input++;
+    }
+    if (starts_with("ANALYZE", input)) {
+        mode = explain_analyze;
+        input += strlen("ANALYZE");
+        while (isspace((unsigned char) *input)) {
+            input++;
+        }
+    }
+    if (starts_with("JSON", input)) {
+        json = true;
+        input += strlen("JSON");
+        while (isspace((unsigned char) *input)) {
+            input++;
+        }
+    }
+
+    if (!starts_with("SELECT", input)) {
+        return false;
+    }
+    return parse_select(s, input, mode, json);
+}
+
+static const struct {
+    const char *name;
+    size_t offset;
+} counter_columns[] = {
+        {"rows_scanned", offsetof(thread_counters, rows_scanned)},
+        {"rows_codec_checked", offsetof(thread_counters, rows_codec_checked)},
+        {"rows_inserted", offsetof(thread_counters, rows_inserted)},
+        {"rows_deleted", offsetof(thread_counters, rows_deleted)},
+        {"rows_updated", offsetof(thread_counters, rows_updated)},
+        {"cells_decoded", offsetof(thread_counters, cells_decoded)},
+        {"field_bytes_read", offsetof(thread_counters, field_bytes_read)},
+        {"join_comparisons", offsetof(thread_counters, join_comparisons)},
+        {"index_probes", offsetof(thread_counters, index_probes)},
+        {"header_writes", offsetof(thread_counters, header_writes)},
+        {"blocks_skipped", offsetof(thread_counters, blocks_skipped)},
+        {"page_reads", offsetof(thread_counters, page_reads)},
+        {"page_hits", offsetof(thread_counters, page_hits)},
+        {"pages_read_ahead", offsetof(thread_counters, pages_read_ahead)},
+        {"bytes_read", offsetof(thread_counters, bytes_read)},
+};
+
+static const char *statement_names[statement_kinds] = {
+        "CREATE TABLE", "CREATE INDEX", "INSERT", "DELETE", "UPDATE", "VACUUM", "SELECT", "EXPLAIN", "SHOW", "OTHER",
+};
+
+statement_kind statement_kind_of(const char *input) {
+    if (starts_with("CREATE TABLE", input)) {
+        return statement_create_table;
+    } else if (starts_with("CREATE INDEX", input)) {
+        return statement_create_index;
+    } else if (starts_with("INSERT", input)) {
+        return statement_insert;
+    } else if (starts_with("DELETE", input)) {
+        return statement_delete;
+    } else if (starts_with("UPDATE", input)) {
+        return statement_update;
+    } else if (starts_with("VACUUM", input)) {
+        return statement_vacuum;
+    } else if (starts_with("SELECT", input)) {
+        return statement_select;
+    } else if (starts_with("EXPLAIN", input)) {
+        return statement_explain;
+    } else if (starts_with("SHOW", input)) {
+        return statement_show;
+    }
+    return statement_other;
+}
+
+// Upper bound in ms of the latency bucket by which pct percent of the
+// statements had completed.
+double latency_percentile(const size_t *buckets, size_t count, size_t pct) {
+    size_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen > 0 && seen * 100 >= count * pct) {
+            return (double) ((uint64_t) 1 << b) / 1000;
+        }
+    }
+    return 0;
+}
+
+bool show_stats(session *s) {
+    thread_counters sum;
+    thread_stats totals = {.counters = &sum};
+    collect_thread_stats(&totals);
+
+    fprintf(s->out, "%-18s %15s\n", "Counter", "Total");
+    for (size_t i = 0; i < sizeof(counter_columns) / sizeof(counter_columns[0]); i++) {
+        fprintf(s->out, "%-18s %15zu\n", counter_columns[i].name,
+                *(const size_t *) ((const char *) &sum + counter_columns[i].offset));
+    }
+
+    // the mechanism in use once a scan has set it up, and the most reads it
+    // has had in flight at once
+    static const char *read_ahead_names[] = {"off", "threads", "uring"};
+    pthread_mutex_lock(&read_ahead.lock);
+    read_ahead_mode mode = read_ahead.mode;
+    size_t peak = read_ahead.peak_in_flight;
+    pthread_mutex_unlock(&read_ahead.lock);
+    fprintf(s->out, "%-18s %15s\n", "read_ahead", read_ahead_names[mode]);
+    fprintf(s->out, "%-18s %15zu\n", "read_ahead_peak", peak);
+
+    fprintf(s->out, "%-18s %10s %10s %10s %10s %10s\n", "Statement", "Count", "p50 ms", "p90 ms", "p99 ms",
+            "max ms");
+    for (int k = 0; k < statement_kinds; k++) {
+        size_t count = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            count += totals.latency[k][b];
+        }
+        if (count == 0) {
+            continue;
+        }
+        fprintf(s->out, "%-18s %10zu %10.3f %10.3f %10.3f %10.3f\n", statement_names[k], count,
+                latency_percentile(totals.latency[k], count, 50), latency_percentile(totals.latency[k], count, 90),
+                latency_percentile(totals.latency[k], count, 99), latency_percentile(totals.latency[k], count, 100));
+    }
+    return true;
+}
+
+bool execute_statement(session *s, const char *input) {
+    if (starts_with("CREATE TABLE", input)) {
+        return parse_create(s, input);
+    } else if (starts_with("INSERT", input)) {
+        return parse_insert(input);
+    } else if (starts_with("DELETE", input)) {
+        return parse_delete(input);
+    } else if (starts_with("UPDATE", input)) {
+        return parse_update(input);
+    } else if (starts_with("VACUUM", input)) {
+        return parse_vacuum(input);
+    } else if (starts_with("SELECT", input)) {
+        return parse_select(s, input, explain_none, false);
+    } else if (starts_with("EXPLAIN", input)) {
+        return parse_explain(s, input);
+    } else if (starts_with("DROP", input)) {
+        //parse_drop(input);
+        return true;
+    } else if (strcmp(input, "SHOW STATS") == 0) {
+        return show_stats(s);
+    } else if (starts_with("SHOW", input)) {
+        return parse_show_table(s, input);
+    } else if (starts_with("CREATE INDEX", input)) {
+        return parse_create_index(s, input);
+    } else if (strcmp(input, "QUIT") == 0) {
+        fputs("Bye\n", s->out);
+        return true;
+    }
+#ifdef DEBUG
+    fprintf(stderr, "Unknown command: %s\n", input);
+#endif
+    //puts(input);
+    return false;
+}
+
+// Runs a statement and records how long it took with its kind.
+bool parse_input(session *s, const char *input) {
+    register_thread_stats();
+
+    double started = now();
+    bool ok = execute_statement(s, input);
+    record_latency(statement_kind_of(input), now() - started);
+    return ok;
+}
 
-    return true;
+// Statements that span several lines and are terminated by END.
+bool is_block_statement(const char *input) {
+    return starts_with("CREATE TABLE", input) || starts_with("CREATE INDEX", input) || starts_with("SELECT", input) ||
+           starts_with("EXPLAIN", input);
 }
 
-table *open_index(const char *name) {
-    table *t = malloc(sizeof(table));
-    t->temporary = true;
-    char filename[FILENAME_MAX];
-    sprintf(filename, "%s.index", name);
-    FILE *fp = fopen(filename, "rb");
-    fread(&t->info, sizeof(table_info), 1, fp);
+typedef struct connection {
+    int fd;
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool busy;
+    bool eof;
+    bool quit;
+    bool line_start;
+    pthread_mutex_t lock;
+    struct connection *next;
+} connection;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    connection *head;
+    connection *tail;
+} work_queue = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .ready = PTHREAD_COND_INITIALIZER,
+};
+
+void work_queue_push(connection *c) {
+    pthread_mutex_lock(&work_queue.lock);
+    c->next = NULL;
+    if (work_queue.tail != NULL) {
+        work_queue.tail->next = c;
+    } else {
+        work_queue.head = c;
+    }
+    work_queue.tail = c;
+    pthread_cond_signal(&work_queue.ready);
+    pthread_mutex_unlock(&work_queue.lock);
+}
 
-    if (ferror(fp)) {
-        free(t);
-        return NULL;
+connection *work_queue_pop(void) {
+    pthread_mutex_lock(&work_queue.lock);
+    while (work_queue.head == NULL) {
+        pthread_cond_wait(&work_queue.ready, &work_queue.lock);
     }
+    connection *c = work_queue.head;
+    work_queue.head = c->next;
+    if (work_queue.head == NULL) {
+        work_queue.tail = NULL;
+    }
+    pthread_mutex_unlock(&work_queue.lock);
+    return c;
+}
 
-    fclose(fp);
+// Length of the first complete statement in buf, or 0 if more input is needed.
+size_t statement_length(const char *buf, size_t len) {
+    const char *nl = memchr(buf, '\n', len);
+    if (nl == NULL) {
+        return 0;
+    }
 
-    sprintf(filename, "%s.index.bin", name);
-    fp = fopen(filename, "rb");
+    char line[INPUT_BUFFER_SIZE];
+    size_t n = nl - buf < INPUT_BUFFER_SIZE - 1 ? nl - buf : INPUT_BUFFER_SIZE - 1;
+    memcpy(line, buf, n);
+    line[n] = 0;
 
-    size_t size = row_size(t->info) * t->info.n_rows * sizeof(uint8_t);
-    t->data = malloc(size);
+    if (!is_block_statement(str_trim(line))) {
+        return nl - buf + 1;
+    }
 
-    fread(t->data, size, 1, fp);
+    const char *p = nl + 1;
+    while ((nl = memchr(p, '\n', len - (p - buf))) != NULL) {
+        n = nl - p < INPUT_BUFFER_SIZE - 1 ? nl - p : INPUT_BUFFER_SIZE - 1;
+        memcpy(line, p, n);
+        line[n] = 0;
+        p = nl + 1;
 
-    if (ferror(fp)) {
-        free(t->data);
-        free(t);
-        return NULL;
+        if (starts_with("END", str_trim(line))) {
+            return p - buf;
+        }
     }
 
-    fclose(fp);
-    return t;
+    return 0;
 }
 
-bool parse_select(const char *input) {
-    // parse select fields
-    char buf[INPUT_BUFFER_SIZE];
+bool send_all(int fd, const char *buf, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, buf, size, MSG_NOSIGNAL);
+        if (n > 0) {
+            buf += n;
+            size -= n;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+            poll(&pfd, 1, -1);
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
 
-    char operator[8];
+// Output stream of a session: lines starting with '.' are escaped with another
+// '.', so a line consisting of ".OK" or ".ERROR" always ends a response.
+ssize_t connection_write(void *cookie, const char *buf, size_t size) {
+    connection *c = cookie;
+    size_t start = 0;
 
-    query q;
-    q.n_fields = 0;
-    q.n_tables = 0;
-    q.n_conditions = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (c->line_start && buf[i] == '.') {
+            if (!send_all(c->fd, buf + start, i - start) || !send_all(c->fd, ".", 1)) {
+                return -1;
+            }
+            start = i;
+        }
+        c->line_start = buf[i] == '\n';
+    }
 
-    char fields[SELECT_MAX][MAX_FIELD_NAME_SIZE] = {0};
+    if (!send_all(c->fd, buf + start, size - start)) {
+        return -1;
+    }
+    return (ssize_t) size;
+}
 
-    if (sscanf(input, "SELECT %[^\n]%*c", buf) == 1) {
+void serve_statement(connection *c, char *statement, size_t len) {
+    char input[INPUT_BUFFER_SIZE];
+    FILE *in = fmemopen(statement, len, "r");
 
-        char *tok = strtok(buf, ",");
-        while (tok != NULL) {
-            strcpy(fields[q.n_fields++], str_trim(tok));
-            tok = strtok(NULL, ",");
+    if (in == NULL || fgets(input, INPUT_BUFFER_SIZE, in) == NULL || strlen(str_trim(input)) < 2) {
+        if (in != NULL) {
+            fclose(in);
         }
+        return;
+    }
 
-//#ifdef DEBUG
-//        for (int i = 0; i < q.n_fields; i++) {
-//            printf("F: %s \n", fields[i]);
-//        }
-//#endif
-
-        do {
-            fgets(buf, INPUT_BUFFER_SIZE, stdin);
-            str_trim(buf);
+    cookie_io_functions_t io = {.write = connection_write};
+    FILE *out = fopencookie(c, "w", io);
+    setvbuf(out, NULL, _IOFBF, CACHE_PAGE_SIZE);
+    c->line_start = true;
 
-#ifndef QUIET
-            printf("===> %s\n", buf);
-#endif
+    session s = {.in = in, .out = out, .format = output_text};
+    bool ok;
 
+    if (starts_with("QUIT", input)) {
+        fputs("Bye\n", out);
+        c->quit = true;
+        ok = true;
+    } else {
+        ok = parse_input(&s, input);
+    }
 
-            if (starts_with("FROM", buf)) {
-                strtok(buf, " ");
-                while ((tok = strtok(NULL, ","))) {
-                    //strcpy(q.tables[q.n_tables++], str_trim(tok));
-                    table *t = open_table(str_trim(tok));
-                    if (t == NULL) {
-                        t = open_index(tok);
-                    }
-                    if (NULL != t) {
-                        q.tables[q.n_tables++] = t;
-                    } else {
-                        fputs("Table does not exist", stderr);
-                        return false;
-                    }
-                }
+    fclose(out);
+    fclose(in);
 
-            } else if (starts_with("WHERE", buf) || starts_with("AND", buf) || starts_with("OR", buf)) {
-                char op1[MAX_FIELD_NAME_SIZE];
-                char op2[MAX_FIELD_NAME_SIZE];
-                char conj[32];
-                sscanf(buf, "%s %s %s %s", conj, op1, operator, op2);
-                int index = q.n_conditions;
+    const char *status = ok ? ".OK\n" : ".ERROR\n";
+    send_all(c->fd, status, strlen(status));
 
-                parse_query_literal(&q.conditions[index].literal1, op1, q.tables, q.n_tables);
-                parse_query_literal(&q.conditions[index].literal2, op2, q.tables, q.n_tables);
-                parse_query_operator(&q.conditions[index].operator, operator);
+    if (c->quit) {
+        shutdown(c->fd, SHUT_RDWR);
+    }
+}
 
-                if (q.conditions[index].literal1.type == literal_type_constant &&
-                    q.conditions[index].literal2.type == literal_type_field) {
-                    literal temp = q.conditions[index].literal1;
-                    q.conditions[index].literal1 = q.conditions[index].literal2;
-                    q.conditions[index].literal2 = temp;
-                }
+void free_connection(connection *c) {
+    close(c->fd);
+    pthread_mutex_destroy(&c->lock);
+    free(c->buf);
+    free(c);
+}
 
-                if (strcmp(conj, "WHERE") == 0 || strcmp(conj, "AND") == 0) {
-                    q.conditions[index].conjunction = conjunction_and;
-                } else if (strcmp(conj, "OR") == 0) {
-                    q.conditions[index].conjunction = conjunction_or;
+void *server_worker(void *arg) {
+    for (;;) {
+        connection *c = work_queue_pop();
+
+        for (;;) {
+            pthread_mutex_lock(&c->lock);
+            size_t n = c->quit ? 0 : statement_length(c->buf, c->len);
+            if (n == 0) {
+                c->busy = false;
+                bool done = c->eof;
+                pthread_mutex_unlock(&c->lock);
+                if (done) {
+                    free_connection(c);
                 }
-                q.n_conditions++;
-            } else if (starts_with("END", buf)) {
                 break;
             }
 
-        } while (!feof(stdin));
+            char *statement = malloc(n);
+            memcpy(statement, c->buf, n);
+            memmove(c->buf, c->buf + n, c->len - n);
+            c->len -= n;
+            pthread_mutex_unlock(&c->lock);
 
-        // normalize field names
-        for (int i = 0; i < q.n_fields; i++) {
-            bool found = false;
-            for (int j = 0; j < q.n_tables; j++) {
-                int col = table_find_field(q.tables[j]->info, fields[i]);
-                if (col != -1) {
-                    strcpy(q.fields[i].table, q.tables[j]->info.name);
-                    strcpy(q.fields[i].field, fields[i]);
-                    q.fields[i].col = col;
-                    found = true;
-                    break;
-                }
-            }
-
-            if (!found) {
-                return false;
-            }
+            serve_statement(c, statement, n);
+            free(statement);
         }
+    }
+    return NULL;
+}
 
+// Reads whatever the client has sent; hands the session to a worker once a
+// whole statement is buffered. Returns false once the connection is gone.
+bool connection_read(int epfd, connection *c) {
+    pthread_mutex_lock(&c->lock);
 
-        if (1 == q.n_tables && !has_self_join(q)) {
-            return single_query(q);
+    for (;;) {
+        if (c->cap - c->len < INPUT_BUFFER_SIZE) {
+            c->cap = c->cap == 0 ? 2 * INPUT_BUFFER_SIZE : 2 * c->cap;
+            c->buf = realloc(c->buf, c->cap);
+        }
+
+        ssize_t n = read(c->fd, c->buf + c->len, c->cap - c->len);
+        if (n > 0) {
+            if (!c->quit) {
+                c->len += n;
+            }
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
         } else {
-            return do_join_query(q);
+            epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+            c->eof = true;
+            break;
         }
-        return true;
     }
 
-    return false;
-}
+    if (!c->busy) {
+        if (statement_length(c->buf, c->len) > 0 && !c->quit) {
+            c->busy = true;
+            work_queue_push(c);
+        } else if (c->eof) {
+            pthread_mutex_unlock(&c->lock);
+            free_connection(c);
+            return false;
+        }
+    }
 
-void parse_drop(const char *input) {
-    puts("DROP");
+    bool open = !c->eof;
+    pthread_mutex_unlock(&c->lock);
+    return open;
 }
 
-bool show_table_info(const table_info t) {
-    printf("Table: %s\n", t.name);
-    printf("Row size: %lu\n", row_size(t));
-    for (int i = 0; i < t.n_fields; i++) {
-        printf("%s\t%s(%lu)\n", t.fields[i].name, field_type_to_str(t.fields[i].type), t.fields[i].length);
-    }
-    return true;
-}
+int server_listen(const char *address) {
+    int fd;
+
+    if (starts_with("unix:", address)) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        strncpy(addr.sun_path, address + 5, sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd == -1 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+            perror("Error binding socket");
+            return -1;
+        }
+    } else {
+        char host[INET_ADDRSTRLEN] = "127.0.0.1";
+        const char *port = strrchr(address, ':');
+        if (port != NULL) {
+            size_t n = port - address < INET_ADDRSTRLEN - 1 ? port - address : INET_ADDRSTRLEN - 1;
+            memcpy(host, address, n);
+            host[n] = 0;
+            port++;
+        } else {
+            port = address;
+        }
 
-bool show_table(const char *table_name) {
-    table_info t;
-    if (read_table_info(&t, table_name)) {
-        return show_table_info(t);
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(atoi(port))};
+        if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+            fprintf(stderr, "Invalid address: %s\n", address);
+            return -1;
+        }
+
+        int on = 1;
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+            bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+            perror("Error binding socket");
+            return -1;
+        }
     }
-    return false;
-}
 
-bool parse_show_table(const char *input) {
-    char table_name[MAX_TABLE_NAME_SIZE];
-    int n = sscanf(input, "SHOW %s", table_name);
-    if (n != 1) {
-        return false;
+    if (listen(fd, SERVER_BACKLOG) == -1) {
+        perror("Error listening");
+        return -1;
     }
 
-    return show_table(table_name);
+    return fd;
 }
 
-int strcmp_wrapper(const void *a, const void *b) {
-#ifdef DEBUG
-    printf("Comparing %s %s\n", (const char *) a, (const char *) b);
-#endif
-    return strcmp((const char *) a, (const char *) b);
-}
+// Serves statements from many clients: one epoll loop does the socket I/O and a
+// pool of workers executes statements, sharing the catalog and the page cache.
+int serve(const char *address, int n_workers) {
+    int listen_fd = server_listen(address);
+    if (listen_fd == -1) {
+        return 1;
+    }
 
-bool parse_create_index(const char *input) {
-    char table_name[MAX_TABLE_NAME_SIZE];
-    char field_names[INPUT_BUFFER_SIZE];
-    char index_name[MAX_TABLE_NAME_SIZE];
-    char buf[INPUT_BUFFER_SIZE];
+    signal(SIGPIPE, SIG_IGN);
 
-    int n = sscanf(input, "CREATE INDEX %s USING %[^\n]%*c", index_name, field_names);
-    if (n != 2) {
-        return false;
-    }
-    fgets(buf, INPUT_BUFFER_SIZE, stdin);
-    n = sscanf(str_trim(buf), "FROM %s", table_name);
-    if (n != 1) {
-        return false;
-    }
-#ifndef QUIET
-    printf("===> %s\n",buf);
-#endif
-    fgets(buf, INPUT_BUFFER_SIZE, stdin);
-    if (strcmp("END", str_trim(buf)) != 0) {
-        fprintf(stderr, "Unknown command: %s\n", buf);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SERVER_STACK_SIZE);
+    for (int i = 0; i < n_workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, server_worker, NULL) != 0) {
+            perror("Error starting worker");
+            return 1;
+        }
+        pthread_detach(thread);
     }
+    pthread_attr_destroy(&attr);
+
+    int epfd = epoll_create1(0);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
 #ifndef QUIET
-    printf("===> %s\n",buf);
+    printf("Listening on %s with %d workers\n", address, n_workers);
 #endif
-    table *t = open_table(table_name);
 
-    if (t == NULL) {
-        fputs("Table not found", stderr);
-        return false;
-    }
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    for (;;) {
+        int n = epoll_wait(epfd, events, SERVER_MAX_EVENTS, -1);
+        if (n == -1 && errno != EINTR) {
+            perror("epoll_wait");
+            return 1;
+        }
 
-    int cols[MAX_TABLE_FIELDS];
-    field fields[MAX_TABLE_FIELDS];
-    int n_cols = 0;
-    char *tok = strtok(field_names, ",");
-    while (tok != NULL) {
-        int col = table_find_field(t->info, str_trim(tok));
-        if (col != -1) {
-            cols[n_cols] = col;
-            fields[n_cols++] = t->info.fields[col];
-        } else {
-            return false;
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr != NULL) {
+                connection_read(epfd, events[i].data.ptr);
+                continue;
+            }
+
+            int fd;
+            while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK)) != -1) {
+                connection *c = calloc(1, sizeof(connection));
+                c->fd = fd;
+                pthread_mutex_init(&c->lock, NULL);
+
+                struct epoll_event cev = {.events = EPOLLIN | EPOLLRDHUP, .data.ptr = c};
+                epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &cev);
+            }
         }
-        tok = strtok(NULL, ",");
     }
+}
 
-    table *tmp = create_temp_table(n_cols, fields, t->info.n_rows);
-    tmp->info.n_rows = t->info.n_rows;
-    uint8_t value[MAX_FIELD_LENGTH];
-    for (int i = 0; i < tmp->info.n_rows; i++) {
-        for (int j = 0; j < n_cols; j++) {
-            read_field(value, t, i, cols[j]);
-            set_temp_table_field(tmp, i, j, value);
+// Writes the generated filter for one column: a loop over rows of a fixed
+// size with the column's offset and type compiled in.
+void generate_column_filter(FILE *out, int codec, const table_info *t, int col) {
+    const field *f = &t->fields[col];
+    size_t size = row_size(*t);
+    size_t offset = seek_pos(*t, 0, col);
+    bool bytes = f->type == field_type_char && !f->dictionary;
+    const char *type = f->dictionary ? "uint16_t" : "int64_t";
+
+    fprintf(out, "// %s\nstatic void codec_%d_filter_%d(const uint8_t *rows, size_t n, const uint8_t *key, "
+                 "bool *selected, bool and) {\n", f->name, codec, col);
+    if (!bytes) {
+        fprintf(out, "    %s k;\n    memcpy(&k, key, sizeof(k));\n", type);
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        fputs(pass == 0 ? "    if (and) {\n" : "    } else {\n", out);
+        fputs("        for (size_t i = 0; i < n; i++) {\n", out);
+        const char *op = pass == 0 ? "&=" : "|=";
+        if (bytes) {
+            // stored values are NUL-padded to the full width, like the key
+            fprintf(out, "            selected[i] %s memcmp(rows + i * %zu + %zu, key, %zu) == 0;\n", op, size,
+                    offset, field_size(*f));
+        } else {
+            fprintf(out, "            %s v;\n", type);
+            fprintf(out, "            memcpy(&v, rows + i * %zu + %zu, sizeof(v));\n", size, offset);
+            fprintf(out, "            selected[i] %s v == k;\n", op);
         }
+        fputs("        }\n", out);
     }
+    fputs("    }\n}\n\n", out);
+}
 
-    qsort(tmp->data, tmp->info.n_rows, row_size(tmp->info), strcmp_wrapper);
-
-    char filename[FILENAME_MAX];
-    sprintf(filename, "%s.index", index_name);
-    FILE *fp = fopen(filename, "wb");
-    fwrite(&tmp->info, sizeof(table_info), 1, fp);
-    fclose(fp);
+// --codegen: writes codecs.h, a schema_codec for the row layout of each of
+// the given .table files, for a build with -DSCHEMA_CODECS.
+int generate_codecs(FILE *out, int n_files, char *files[]) {
+    uint64_t *fingerprints = calloc((size_t) n_files + 1, sizeof(uint64_t));
+    int n_codecs = 0;
+
+    fputs("// Generated by database --codegen; do not edit.\n\n", out);
+    for (int i = 0; i < n_files; i++) {
+        table_info info;
+        FILE *fp = fopen(files[i], "rb");
+        bool ok = fp != NULL && fread(&info, sizeof(info), 1, fp) == 1 && info.n_fields >= 0 &&
+                  info.n_fields <= MAX_TABLE_FIELDS;
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        if (!ok) {
+            fprintf(stderr, "%s: not a table definition\n", files[i]);
+            free(fingerprints);
+            return 1;
+        }
 
-    sprintf(filename, "%s.index.bin", index_name);
-    fp = fopen(filename, "wb");
-    fwrite(tmp->data, row_size(tmp->info) * tmp->info.n_rows * sizeof(uint8_t), 1, fp);
-    fclose(fp);
+        // tables of the same layout share one codec
+        uint64_t fingerprint = schema_fingerprint(&info);
+        bool seen = false;
+        for (int k = 0; k < n_codecs; k++) {
+            seen = seen || fingerprints[k] == fingerprint;
+        }
+        if (seen) {
+            continue;
+        }
 
-    //close_temp_table(tmp);
+        fprintf(out, "// table %s, %zu-byte rows\n\n", info.name, row_size(info));
+        for (int col = 0; col < info.n_fields; col++) {
+            if (info.fields[col].type != field_type_undefined) {
+                generate_column_filter(out, n_codecs, &info, col);
+            }
+        }
+        fprintf(out, "static const schema_codec codec_%d = {UINT64_C(0x%016" PRIx64 "), {", n_codecs, fingerprint);
+        for (int col = 0; col < info.n_fields; col++) {
+            if (info.fields[col].type != field_type_undefined) {
+                fprintf(out, "%scodec_%d_filter_%d", col > 0 ? ", " : "", n_codecs, col);
+            } else {
+                fprintf(out, "%sNULL", col > 0 ? ", " : "");
+            }
+        }
+        fputs("}};\n\n", out);
+        fingerprints[n_codecs++] = fingerprint;
+    }
 
-#ifdef DEBUG
-    print_table(tmp);
-#endif
+    fputs("static const schema_codec *const schema_codecs[] = {", out);
+    for (int k = 0; k < n_codecs; k++) {
+        fprintf(out, "&codec_%d, ", k);
+    }
+    fputs("NULL};\n", out);
 
-    return true;
+    free(fingerprints);
+    return ferror(out) ? 1 : 0;
 }
 
-bool parse_input(const char *input) {
-    if (starts_with("CREATE TABLE", input)) {
-        return parse_create(input);
-    } else if (starts_with("INSERT", input)) {
-        return parse_insert(input);
-    } else if (starts_with("DELETE", input)) {
-        return parse_delete(input);
-    } else if (starts_with("SELECT", input)) {
-        return parse_select(input);
-    } else if (starts_with("DROP", input)) {
-        //parse_drop(input);
-        return true;
-    } else if (starts_with("SHOW", input)) {
-        return parse_show_table(input);
-    } else if (starts_with("CREATE INDEX", input)) {
-        return parse_create_index(input);
-    } else if (strcmp(input, "QUIT") == 0) {
-        puts("Bye");
-        return true;
+int main(int argc, char *argv[]) {
+    char input[INPUT_BUFFER_SIZE];
+    const char *address = NULL;
+    int n_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            address = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            n_workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stats-log") == 0 && i + 1 < argc) {
+            stats_log.fp = fopen(argv[++i], "a");
+            if (stats_log.fp == NULL) {
+                perror(argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--read-ahead") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "uring") == 0) {
+                read_ahead.mode = read_ahead_uring;
+            } else if (strcmp(argv[i], "threads") == 0) {
+                read_ahead.mode = read_ahead_threads;
+            } else if (strcmp(argv[i], "off") == 0) {
+                read_ahead.mode = read_ahead_off;
+            } else {
+                fprintf(stderr, "%s: unknown read-ahead mode\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--codegen") == 0) {
+            return generate_codecs(stdout, argc - i - 1, argv + i + 1);
+        } else {
+            fprintf(stderr, "Usage: %s [--listen [host:]port | --listen unix:path] [--workers n] [--stats-log file]"
+                            " [--read-ahead uring|threads|off] [--codegen file.table...]\n", argv[0]);
+            return 1;
+        }
     }
-#ifdef DEBUG
-    fprintf(stderr, "Unknown command: %s\n", input);
-#endif
-    //puts(input);
-    return false;
-}
 
-int main() {
-    char input[INPUT_BUFFER_SIZE];
+    if (address != NULL) {
+        return serve(address, n_workers > 0 ? n_workers : 1);
+    }
+
+    session s = {.in = stdin, .out = stdout, .format = output_text};
 
 #ifndef QUIET
     puts("Welcome!");
@@ -1060,7 +6166,7 @@ int main() {
         if (starts_with("QUIT", input)) {
             break;
         } else {
-            parse_input(input);
+            parse_input(&s, input);
         }
     } while (!feof(stdin));
 
@@ -1068,4 +6174,4 @@ int main() {
     puts("Goodbye!");
 #endif
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,37 @@
+#!/bin/sh
+# The data generator is deterministic and its script loads into database as
+# generated, and a small benchmark run completes every scenario without
+# errors.
+repo="$(cd "$(dirname "$0")/.." && pwd)"
+db="$repo/database"
+bench="$repo/benchmark"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+"$bench" gen -n 500 > script || fail "gen failed"
+"$bench" gen -n 500 | cmp -s - script || fail "gen is not deterministic"
+"$db" < script > /dev/null
+
+for table in employee department schedule shift needs roles; do
+    inserted=$(grep -c "^INSERT INTO $table " script)
+    field=$(awk -v t="$table" '$1 == "CREATE" && $3 == t { getline; print $2; exit }' script)
+    stored=$(printf 'SELECT %s\nFROM %s\nEND\n' "$field" "$table" | "$db" | wc -l)
+    [ "$stored" -eq "$inserted" ] || fail "$table holds $stored of $inserted generated rows"
+done
+[ "$(grep -c '^INSERT INTO schedule ' script)" -eq 500 ] || fail "gen -n 500 did not make 500 schedules"
+
+mkdir run
+"$bench" run -n 500 -r 1 -j 1 -c 2 -w 2 -d run -b "$db" > report 2>&1 || fail "run failed: $(tail -3 report)"
+scenarios=$(awk '$NF ~ /^[0-9]+$/ && NF > 9' report | wc -l)
+[ "$scenarios" -gt 0 ] || fail "the report lists no scenarios"
+errors=$(awk '$NF ~ /^[0-9]+$/ && NF > 9 && $NF != 0' report)
+[ -z "$errors" ] || fail "scenarios with errors: $errors"
+grep -q '^join 1 .* 0$' report || fail "the report has no join scenario"
+
+echo "PASS: $(basename "$0")"
@@ -0,0 +1,87 @@
+#!/bin/sh
+# FORMAT BINARY returns the same rows as text, in the columnar layout the
+# README describes: header, batches of up to 4096 rows, an empty batch and a
+# newline.
+db="$(cd "$(dirname "$0")/.." && pwd)/database"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+# Decodes a binary result on stdin: the column header goes to "columns",
+# the batch sizes to "batches" and the rows to stdout as CSV.
+decode() {
+    od -An -v -tu1 | awk '
+        { for (i = 1; i <= NF; i++) b[n++] = $i }
+        function u32(p) { return b[p] + b[p + 1] * 256 + b[p + 2] * 65536 + b[p + 3] * 16777216 }
+        function i64(p,    v, k) {
+            v = 0
+            for (k = 7; k >= 0; k--) v = v * 256 + b[p + k]
+            return v
+        }
+        function text(p, len,    s, k) {
+            s = ""
+            for (k = 0; k < len; k++) s = s sprintf("%c", b[p + k])
+            return s
+        }
+        END {
+            magic = text(0, 8)
+            cols = u32(8)
+            p = 12
+            header = magic " " cols
+            for (j = 0; j < cols; j++) {
+                type[j] = b[p]
+                header = header " " type[j] ":" text(p + 2, b[p + 1])
+                p += 2 + b[p + 1]
+            }
+            print header > "columns"
+            for (;;) {
+                rows = u32(p)
+                p += 4
+                print rows > "batches"
+                if (rows == 0) break
+                for (j = 0; j < cols; j++) {
+                    if (type[j] == 1) {
+                        for (r = 0; r < rows; r++) cell[r, j] = sprintf("%.0f", i64(p + r * 8))
+                        p += rows * 8
+                    } else {
+                        base = p + (rows + 1) * 4
+                        for (r = 0; r < rows; r++) cell[r, j] = text(base + u32(p + r * 4), u32(p + r * 4 + 4) - u32(p + r * 4))
+                        p = base + u32(p + rows * 4)
+                    }
+                }
+                for (r = 0; r < rows; r++) {
+                    line = cell[r, 0]
+                    for (j = 1; j < cols; j++) line = line "," cell[r, j]
+                    print line
+                }
+            }
+            print (p + 1 == n && b[p] == 10) ? "end" : "trailing bytes" > "batches"
+        }'
+}
+
+"$db" > /dev/null <<'END_OF_INPUT'
+CREATE TABLE t
+ADD id int 8
+ADD name char 20
+ADD state char 12 DICTIONARY
+END
+END_OF_INPUT
+seq 0 4999 | awk '{ printf "INSERT INTO t %.0f,name%d,s%d\n", $1 + 5000000000, $1 % 7 * 1000, $1 % 3 }' |
+    "$db" > /dev/null
+
+printf 'SELECT id, name, state\nFROM t\nEND\n' | "$db" > text
+printf 'SELECT id, name, state\nFROM t\nFORMAT BINARY\nEND\n' | "$db" | decode > decoded
+[ "$(cat columns)" = "DBCOLS01 3 1:id 0:name 0:state" ] || fail "the header read '$(cat columns)'"
+[ "$(tr '\n' ' ' < batches)" = "4096 904 0 end " ] || fail "the batches were '$(tr '\n' ' ' < batches)'"
+cmp -s text decoded || fail "the binary rows differ from the text ones: $(diff text decoded | head -3)"
+
+printf 'SELECT id, name\nFROM t\nWHERE state = "s9"\nFORMAT BINARY\nEND\n' | "$db" | decode > empty
+[ ! -s empty ] || fail "an empty result decoded to rows"
+[ "$(tr '\n' ' ' < batches)" = "0 end " ] || fail "an empty result held batches '$(tr '\n' ' ' < batches)'"
+
+echo "PASS: $(basename "$0")"
@@ -0,0 +1,72 @@
+#!/bin/sh
+# DELETE hides rows from scans and hash index lookups, UPDATE appends the new
+# version of a row and deletes the old one, and VACUUM keeps the visible rows
+# and rebuilds the indexes made from the table.
+db="$(cd "$(dirname "$0")/.." && pwd)/database"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+select_all() {
+    printf 'SELECT %s\nFROM %s\nEND\n' "$2" "$1" | "$db" | tr '\n' ' '
+}
+
+"$db" <<'END_OF_INPUT'
+CREATE TABLE t
+ADD id int 8
+ADD city char 10 DICTIONARY
+ADD name char 10
+END
+INSERT INTO t 0,x,a
+INSERT INTO t 1,y,b
+INSERT INTO t 2,x,c
+INSERT INTO t 3,z,d
+CREATE INDEX s USING name, id
+FROM t
+END
+CREATE INDEX h USING HASH city, id, name
+FROM t
+END
+END_OF_INPUT
+
+printf 'DELETE FROM t WHERE id = 1\n' | "$db"
+out=$(select_all t "id, city, name")
+[ "$out" = "0,x,a 2,x,c 3,z,d " ] || fail "scan after DELETE returned '$out'"
+out=$(printf 'SELECT city, id\nFROM h\nWHERE city = "y"\nEND\n' | "$db")
+[ -z "$out" ] || fail "hash lookup of a deleted row returned '$out'"
+
+# the new version goes to the end of the table
+printf 'UPDATE t SET city = "x", name = "e f" WHERE id = 3\n' | "$db"
+out=$(select_all t "id, city, name")
+[ "$out" = "0,x,a 2,x,c 3,x,e f " ] || fail "scan after UPDATE returned '$out'"
+out=$(printf 'SELECT city, id, name\nFROM h\nWHERE city = "x"\nEND\n' | "$db" | sort | tr '\n' ' ')
+[ "$out" = "x,0,a x,2,c x,3,e f " ] || fail "hash lookup after UPDATE returned '$out'"
+out=$(printf 'SELECT city, id\nFROM h\nWHERE city = "z"\nEND\n' | "$db")
+[ -z "$out" ] || fail "hash lookup of an updated row's old value returned '$out'"
+
+# an UPDATE does not see the versions it appends, so each row changes once
+printf 'UPDATE t SET id = 7 WHERE city = "x"\n' | "$db"
+out=$(select_all t "id, name")
+[ "$out" = "7,a 7,c 7,e f " ] || fail "UPDATE matching its own new rows left '$out'"
+
+# sorted indexes keep the values they were built from until VACUUM
+out=$(select_all s "name, id")
+[ "$out" = "a,0 b,1 c,2 d,3 " ] || fail "sorted index before VACUUM returned '$out'"
+printf 'VACUUM t\n' | "$db"
+out=$(select_all t "id, city, name")
+[ "$out" = "7,x,a 7,x,c 7,x,e f " ] || fail "scan after VACUUM returned '$out'"
+out=$(select_all s "name, id")
+[ "$out" = "a,7 c,7 e f,7 " ] || fail "sorted index after VACUUM returned '$out'"
+out=$(printf 'SELECT city, id, name\nFROM h\nWHERE city = "x"\nEND\n' | "$db" | sort | tr '\n' ' ')
+[ "$out" = "x,7,a x,7,c x,7,e f " ] || fail "hash lookup after VACUUM returned '$out'"
+
+printf 'INSERT INTO t 8,y,g\n' | "$db"
+out=$(printf 'SELECT city, id, name\nFROM h\nWHERE city = "y"\nEND\n' | "$db")
+[ "$out" = "y,8,g" ] || fail "hash lookup of a row inserted after VACUUM returned '$out'"
+
+echo "PASS: $(basename "$0")"
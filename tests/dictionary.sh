@@ -0,0 +1,64 @@
+#!/bin/sh
+# DICTIONARY columns store codes into <table>.dict and return the values they
+# encode: after reopening, through equality filters, and in joins between
+# dictionary columns whose tables gave the values different codes.
+db="$(cd "$(dirname "$0")/.." && pwd)/database"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+"$db" > /dev/null <<'END_OF_INPUT'
+CREATE TABLE person UNCOMPRESSED
+ADD id int 8
+ADD state char 30 DICTIONARY
+END
+CREATE TABLE plain UNCOMPRESSED
+ADD id int 8
+ADD state char 30
+END
+CREATE TABLE capital
+ADD cstate char 30 DICTIONARY
+ADD city char 20
+END
+INSERT INTO capital Texas,Austin
+INSERT INTO capital Ohio,Columbus
+INSERT INTO capital Maine,Augusta
+END_OF_INPUT
+
+# every insert runs in a process of its own, which reloads the dictionary
+for i in $(seq 0 59); do
+    case $((i % 3)) in
+        0) state=Maine ;;
+        1) state=Ohio ;;
+        2) state="New York" ;;
+    esac
+    printf 'INSERT INTO person %d,%s\nINSERT INTO plain %d,%s\n' $i "$state" $i "$state"
+done > inserts
+head -30 inserts | "$db" > /dev/null
+tail -n +31 inserts | "$db" > /dev/null
+
+[ -s person.dict ] || fail "no dictionary was written"
+# 8-byte ids and 2-byte codes, after the 64-byte header
+[ "$(wc -c < person.bin)" -eq $((64 + 60 * 10)) ] || fail "person.bin is $(wc -c < person.bin) bytes"
+
+for t in person plain; do
+    printf 'SELECT id, state\nFROM %s\nEND\n' $t | "$db" > "all.$t"
+    printf 'SELECT id, state\nFROM %s\nWHERE state = "New York"\nEND\n' $t | "$db" > "ny.$t"
+done
+cmp -s all.person all.plain || fail "dictionary values decoded wrong: $(diff all.person all.plain | head -3)"
+cmp -s ny.person ny.plain || fail "the filter on the dictionary column returned other rows"
+[ "$(wc -l < ny.person)" -eq 20 ] || fail "the filter returned $(wc -l < ny.person) rows"
+out=$(printf 'SELECT id\nFROM person\nWHERE state = "Texas"\nEND\n' | "$db")
+[ -z "$out" ] || fail "a value outside the dictionary matched '$out'"
+
+out=$(printf 'SELECT state, city\nFROM person, capital\nWHERE state = cstate\nAND id = 1\nEND\n' | "$db")
+[ "$out" = "Ohio,Columbus" ] || fail "the join of dictionary columns returned '$out'"
+out=$(printf 'SELECT id, city\nFROM person, capital\nWHERE state = cstate\nEND\n' | "$db" | wc -l)
+[ "$out" -eq 40 ] || fail "the join of dictionary columns returned $out rows"
+
+echo "PASS: $(basename "$0")"
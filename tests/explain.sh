@@ -0,0 +1,66 @@
+#!/bin/sh
+# EXPLAIN prints the plan without running it, EXPLAIN ANALYZE runs it and
+# reports rows per operator, JSON gives one object per line, --stats-log
+# appends one for every SELECT, and long conditions are cut to fit.
+db="$(cd "$(dirname "$0")/.." && pwd)/database"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+"$db" > /dev/null <<'END_OF_INPUT'
+CREATE TABLE emp
+ADD eid int 8
+ADD ename char 10
+ADD dept char 6
+END
+CREATE TABLE sched
+ADD sid int 8
+ADD s_eid int 8
+END
+INSERT INTO emp 1,ann,a
+INSERT INTO emp 2,bob,b
+INSERT INTO emp 3,cid,a
+INSERT INTO emp 4,dee,c
+INSERT INTO sched 10,1
+INSERT INTO sched 11,2
+INSERT INTO sched 12,1
+END_OF_INPUT
+
+out=$(printf 'EXPLAIN SELECT ename\nFROM emp\nWHERE dept = "a"\nEND\n' | "$db" | awk '{ print $1 }' | tr '\n' ' ')
+[ "$out" = "Plan: Scan Project " ] || fail "EXPLAIN printed '$out'"
+
+printf 'EXPLAIN ANALYZE SELECT ename, sid\nFROM emp, sched\nWHERE eid = s_eid\nAND dept = "a"\nEND\n' | "$db" > analyze
+grep -q '^Plan: do_join_query$' analyze || fail "EXPLAIN ANALYZE named no join plan"
+[ "$(awk '$1 == "Filter" { print $3, $4 }' analyze)" = "4 2" ] || fail "Filter rows were not 4 in, 2 out"
+[ "$(awk '$1 == "Project" { print $4 }' analyze)" = 2 ] || fail "Project did not output 2 rows"
+grep -q '^Total: .* 2 rows' analyze || fail "the total is not 2 rows"
+if grep -q '^ann,' analyze; then
+    fail "EXPLAIN ANALYZE printed the result rows"
+fi
+
+out=$(printf 'EXPLAIN ANALYZE JSON SELECT ename\nFROM emp\nWHERE dept = "a"\nEND\n' | "$db")
+case $out in
+    '{"plan":"single_query",'*'"rows":2,'*'"operator":"Scan"'*'}') ;;
+    *) fail "EXPLAIN ANALYZE JSON printed '$out'" ;;
+esac
+
+printf 'SELECT ename\nFROM emp\nEND\nSELECT ename, sid\nFROM emp, sched\nWHERE eid = s_eid\nEND\n' |
+    "$db" --stats-log stats.json > /dev/null
+[ "$(grep -c '^{"statement":"SELECT ename.*"rows":[0-9]*,.*}$' stats.json)" -eq 2 ] ||
+    fail "the stats log holds $(wc -l < stats.json) lines, not one per SELECT"
+
+long=$(head -c 1500 /dev/zero | tr '\0' 'x')
+printf 'EXPLAIN SELECT ename, sid\nFROM emp, sched\nWHERE eid = s_eid\nAND ename = "%s"\nEND\n' "$long" | "$db" > long
+filter=$(grep '^Filter' long) || fail "no Filter for the long condition"
+[ ${#filter} -le 300 ] || fail "the Filter line is ${#filter} characters"
+case $filter in
+    *'emp: ename = "xxx'*) ;;
+    *) fail "the Filter line was '$filter'" ;;
+esac
+
+echo "PASS: $(basename "$0")"
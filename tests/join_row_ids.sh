@@ -0,0 +1,101 @@
+#!/bin/sh
+# Joins pass row ids and fetch the projected fields at output: results hold
+# the right fields of each joined table, leave deleted rows out, and semi
+# joins run only where a filter has reduced an input.
+db="$(cd "$(dirname "$0")/.." && pwd)/database"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+"$db" > /dev/null <<'END_OF_INPUT'
+CREATE TABLE emp
+ADD eid int 8
+ADD ename char 10
+ADD dept char 6 DICTIONARY
+END
+CREATE TABLE sched UNCOMPRESSED
+ADD sid int 8
+ADD s_eid int 8
+ADD shift char 6
+END
+CREATE TABLE shift
+ADD shift_id char 6
+ADD timing char 10
+END
+INSERT INTO emp 1,ann,a
+INSERT INTO emp 2,bob,b
+INSERT INTO emp 3,cid,a
+INSERT INTO emp 4,dee,c
+INSERT INTO sched 10,1,m
+INSERT INTO sched 11,2,e
+INSERT INTO sched 12,1,e
+INSERT INTO sched 13,3,n
+INSERT INTO sched 14,9,m
+INSERT INTO shift m,morning
+INSERT INTO shift e,evening
+INSERT INTO shift n,night
+DELETE FROM sched WHERE sid = 13
+CREATE INDEX ie USING eid, ename
+FROM emp
+END
+CREATE INDEX is USING s_eid, sid
+FROM sched
+END
+END_OF_INPUT
+
+query() {
+    printf '%s\nEND\n' "$1" | "$db" | tr '\n' ' '
+}
+
+out=$(query 'SELECT ename, sid
+FROM emp, sched
+WHERE eid = s_eid')
+[ "$out" = "ann,10 ann,12 bob,11 " ] || fail "two-table join returned '$out'"
+
+out=$(query 'SELECT ename, sid, timing
+FROM emp, sched, shift
+WHERE eid = s_eid
+AND shift = shift_id')
+[ "$out" = "ann,10,morning ann,12,evening bob,11,evening " ] || fail "three-table join returned '$out'"
+
+out=$(query 'SELECT ename, timing, dept
+FROM emp, sched, shift
+WHERE eid = s_eid
+AND shift = shift_id
+AND dept = "a"')
+[ "$out" = "ann,morning,a ann,evening,a " ] || fail "filtered join returned '$out'"
+
+out=$(query 'SELECT ename, sid
+FROM ie, is
+WHERE eid = s_eid')
+[ "$out" = "ann,10 ann,12 bob,11 " ] || fail "join of indexes returned '$out'"
+
+semi_joins() {
+    printf 'EXPLAIN %s\nEND\n' "$1" | "$db" | grep -c '^Semi Join'
+}
+n=$(semi_joins 'SELECT ename, sid, timing
+FROM emp, sched, shift
+WHERE eid = s_eid
+AND shift = shift_id')
+[ "$n" -eq 0 ] || fail "$n semi joins without a filter"
+# the filter on emp reaches shift through sched, and what shift drops
+# goes back to emp
+n=$(semi_joins 'SELECT ename, timing
+FROM emp, sched, shift
+WHERE eid = s_eid
+AND shift = shift_id
+AND dept = "a"')
+[ "$n" -eq 3 ] || fail "$n semi joins with a filter on the first table"
+n=$(semi_joins 'SELECT ename, timing
+FROM emp, sched, shift
+WHERE eid = s_eid
+AND shift = shift_id
+AND timing = "night"')
+[ "$n" -eq 2 ] || fail "$n semi joins with a filter on the last table"
+
+echo "PASS: $(basename "$0")"
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Joins of indexes on their leading char column run as merge joins, chain
+# into later merges on the same key, and return the rows a nested loop over
+# the tables returns, duplicates and unmatched keys included.
+db="$(cd "$(dirname "$0")/.." && pwd)/database"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+{
+    printf 'CREATE TABLE a\nADD akey char 8\nADD aval int 8\nEND\n'
+    printf 'CREATE TABLE b\nADD bkey char 8\nADD bval int 8\nEND\n'
+    printf 'CREATE TABLE c\nADD ckey char 8\nADD cval int 8\nEND\n'
+    # keys repeat on every side, and some are on one side only
+    seq 0 299 | awk '{ printf "INSERT INTO a k%d,%d\nINSERT INTO b k%d,%d\nINSERT INTO c k%d,%d\n",
+                                $1 % 50, $1, $1 * 7 % 80, $1, $1 % 30, $1 }'
+    printf 'CREATE INDEX ia USING akey, aval\nFROM a\nEND\n'
+    printf 'CREATE INDEX ib USING bkey, bval\nFROM b\nEND\n'
+    printf 'CREATE INDEX ic USING ckey, cval\nFROM c\nEND\n'
+} | "$db" > /dev/null
+
+join='SELECT aval, bval, cval\nFROM %s, %s, %s\nWHERE akey = bkey\nAND bkey = ckey\n%bEND\n'
+printf "EXPLAIN $join" ia ib ic '' | "$db" > plan
+[ "$(grep -c '^Merge Join ' plan)" -eq 2 ] || fail "the index join did not merge twice: $(tr '\n' ' ' < plan)"
+if grep -q '^Nested Loop Join ' plan; then
+    fail "the index join fell back to a nested loop"
+fi
+printf "EXPLAIN $join" a b c '' | "$db" > plan
+grep -q '^Merge Join ' plan && fail "a join of unsorted tables merged"
+
+printf "$join" ia ib ic '' | "$db" | sort > merged
+printf "$join" a b c '' | "$db" | sort > nested
+[ -s merged ] || fail "the merge join returned no rows"
+cmp -s merged nested || fail "the merge join returned $(wc -l < merged) rows, the nested loop $(wc -l < nested)"
+
+# a filter on the right input leaves rows out of the merge
+# bval 3 has key k21, which six rows of a and ten of c hold
+printf "$join" ia ib ic 'AND bval = 3\n' | "$db" | sort > merged
+seq 0 299 | awk '$1 % 50 == 21 { a[$1] } $1 % 30 == 21 { c[$1] }
+                 END { for (i in a) for (j in c) printf "%d,3,%d\n", i, j }' | sort > want
+cmp -s merged want || fail "the filtered merge join returned '$(tr '\n' ' ' < merged)'"
+
+echo "PASS: $(basename "$0")"
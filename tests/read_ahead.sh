@@ -0,0 +1,40 @@
+#!/bin/sh
+# A full scan returns the same rows with read-ahead through io_uring (or its
+# fallback where there is none), forced to the thread fallback, and off, and
+# SHOW STATS reports the pages read ahead and the peak queue depth.
+db="$(cd "$(dirname "$0")/.." && pwd)/database"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+# many more rows than fit in one page, so the scan reads ahead
+{
+    printf 'CREATE TABLE t\nADD id int 8\nADD name char 20\nEND\n'
+    seq 0 99999 | sed 's/.*/INSERT INTO t &,name&/'
+} | "$db" > /dev/null
+
+for mode in uring threads off; do
+    printf 'SELECT id, name\nFROM t\nEND\nSHOW STATS\n' | "$db" --read-ahead $mode > out
+    grep '^[0-9]' out > "rows.$mode"
+    grep -v '^[0-9]' out > "stats.$mode"
+done
+
+stat() {
+    awk -v name="$2" '$1 == name { print $2 }' "stats.$1"
+}
+
+[ "$(wc -l < rows.off)" -eq 100000 ] || fail "the scan returned $(wc -l < rows.off) rows"
+cmp -s rows.off rows.threads || fail "the thread fallback returned other rows"
+cmp -s rows.off rows.uring || fail "read-ahead through $(stat uring read_ahead) returned other rows"
+
+[ "$(stat threads read_ahead)" = threads ] || fail "read-ahead was $(stat threads read_ahead), not threads"
+[ "$(stat threads pages_read_ahead)" -gt 0 ] || fail "the thread fallback read no pages ahead"
+[ "$(stat threads read_ahead_peak)" -gt 0 ] || fail "the thread fallback had no reads in flight"
+[ "$(stat off pages_read_ahead)" -eq 0 ] || fail "pages were read ahead with read-ahead off"
+
+echo "PASS: $(basename "$0")"
@@ -0,0 +1,66 @@
+#!/bin/bash
+# Server mode: clients over loopback share one catalog, each response ends
+# with .OK or .ERROR, result lines starting with . get another ., and
+# concurrent sessions all get their inserts in.
+db="$(cd "$(dirname "$0")/.." && pwd)/database"
+dir=$(mktemp -d)
+port=$((20000 + ($$ + 7919) % 20000))
+trap 'kill $server 2>/dev/null; rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+printf 'CREATE TABLE t\nADD id int 8\nADD name char 10\nEND\n' | "$db" > /dev/null
+
+"$db" --listen $port --workers 4 > server.log 2>&1 &
+server=$!
+for _ in $(seq 50); do
+    (exec 3<>/dev/tcp/127.0.0.1/$port) 2>/dev/null && break
+    sleep 0.1
+done
+
+# Sends statements and prints the response up to its n-th status line.
+session() {
+    local n=$1 line
+    exec 3<>/dev/tcp/127.0.0.1/$port || return 1
+    printf '%s\n' "$2" >&3
+    while [ "$n" -gt 0 ] && read -r line <&3; do
+        echo "$line"
+        case $line in
+            .OK | .ERROR) n=$((n - 1)) ;;
+        esac
+    done
+    exec 3<&-
+}
+
+out=$(session 3 'INSERT INTO t 0,.dot
+SELECT name, id
+FROM t
+END
+SELECT nope
+FROM missing
+END' | tr '\n' ' ')
+[ "$out" = ".OK ..dot,0 .OK .ERROR " ] || fail "responses were '$out'"
+
+clients=8
+rows=200
+pids=()
+for c in $(seq $clients); do
+    statements=$(seq $rows | sed "s/.*/INSERT INTO t $c,n&/")
+    session $rows "$statements" > "client$c" &
+    pids+=($!)
+done
+wait "${pids[@]}"
+for c in $(seq $clients); do
+    [ "$(grep -c '^\.OK$' "client$c")" -eq $rows ] || fail "client $c got $(grep -c '^\.OK$' "client$c") of $rows OKs"
+done
+
+out=$(session 1 'SELECT id
+FROM t
+END' | grep -vc '^\.')
+[ "$out" -eq $((clients * rows + 1)) ] || fail "the table holds $out rows"
+
+echo "PASS: $(basename "$0")"
@@ -0,0 +1,71 @@
+#!/bin/bash
+# SHOW STATS counts the work of every statement since startup, summed over
+# the threads of a server, with the latency of each statement type.
+db="$(cd "$(dirname "$0")/.." && pwd)/database"
+dir=$(mktemp -d)
+port=$((20000 + ($$ + 4001) % 20000))
+trap 'kill $server 2>/dev/null; rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+# the figure in column $2 (default 2) of the stats line named $1
+stat() {
+    awk -v name="$1" -v col="${2:-2}" '$1 == name { print $col }' stats
+}
+
+{
+    printf 'CREATE TABLE t\nADD id int 8\nADD name char 10\nEND\n'
+    seq 100 | sed 's/.*/INSERT INTO t &,n&/'
+    printf 'SELECT id\nFROM t\nEND\n'
+    printf 'DELETE FROM t WHERE id = 3\nUPDATE t SET name = "x" WHERE id = 4\nSHOW STATS\n'
+} | "$db" | sed -n '/^Counter /,$p' > stats
+
+[ "$(stat rows_inserted)" -eq 100 ] || fail "rows_inserted is $(stat rows_inserted)"
+[ "$(stat rows_deleted)" -eq 1 ] || fail "rows_deleted is $(stat rows_deleted)"
+[ "$(stat rows_updated)" -eq 1 ] || fail "rows_updated is $(stat rows_updated)"
+[ "$(stat rows_scanned)" -ge 100 ] || fail "rows_scanned is $(stat rows_scanned)"
+[ "$(stat INSERT)" -eq 100 ] || fail "$(stat INSERT) INSERT statements were counted"
+[ "$(stat SELECT)" -eq 1 ] || fail "$(stat SELECT) SELECT statements were counted"
+[ "$(stat CREATE 3)" -eq 1 ] || fail "$(stat CREATE 3) CREATE TABLE statements were counted"
+grep -q '^EXPLAIN ' stats && fail "a statement type that never ran has a line"
+# p50 <= p90 <= p99 <= max, and all of them above zero
+awk '$1 == "INSERT" { exit !(0 < $3 && $3 <= $4 && $4 <= $5 && $5 <= $6) }' stats ||
+    fail "INSERT latencies are out of order: $(grep '^INSERT ' stats)"
+
+"$db" --listen $port --workers 4 > server.log 2>&1 &
+server=$!
+for _ in $(seq 50); do
+    (exec 3<>/dev/tcp/127.0.0.1/$port) 2>/dev/null && break
+    sleep 0.1
+done
+
+# Sends statements and prints the response up to its n-th status line.
+session() {
+    local n=$1 line
+    exec 3<>/dev/tcp/127.0.0.1/$port || return 1
+    printf '%s\n' "$2" >&3
+    while [ "$n" -gt 0 ] && read -r line <&3; do
+        echo "$line"
+        case $line in
+            .OK | .ERROR) n=$((n - 1)) ;;
+        esac
+    done
+    exec 3<&-
+}
+
+# inserts from clients served by different workers add up
+pids=()
+for c in 1 2 3 4; do
+    session 50 "$(seq 50 | sed "s/.*/INSERT INTO t 1000,c$c/")" > /dev/null &
+    pids+=($!)
+done
+wait "${pids[@]}"
+session 1 'SHOW STATS' > stats
+[ "$(stat rows_inserted)" -eq 200 ] || fail "the server counted $(stat rows_inserted) of 200 inserted rows"
+[ "$(stat INSERT)" -eq 200 ] || fail "the server counted $(stat INSERT) of 200 INSERT statements"
+
+echo "PASS: $(basename "$0")"
@@ -0,0 +1,79 @@
+#!/bin/bash
+# SELECTs read a snapshot while another session inserts: each sees a prefix
+# of the committed rows, never fewer than the one before. A session streaming
+# a result keeps its rows when another session replaces the table.
+db="$(cd "$(dirname "$0")/.." && pwd)/database"
+dir=$(mktemp -d)
+port=$((20000 + ($$ + 3571) % 20000))
+trap 'kill $server 2>/dev/null; rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+printf 'CREATE TABLE t\nADD id int 8\nEND\n' | "$db" > /dev/null
+{
+    printf 'CREATE TABLE big\nADD id int 8\nADD name char 20\nEND\n'
+    seq 0 199999 | sed 's/.*/INSERT INTO big &,name&/'
+} | "$db" > /dev/null
+
+"$db" --listen $port > server.log 2>&1 &
+server=$!
+for _ in $(seq 50); do
+    (exec 3<>/dev/tcp/127.0.0.1/$port) 2>/dev/null && break
+    sleep 0.1
+done
+
+# Reads a response from fd $1 up to its status line, without the status.
+response() {
+    local line
+    while read -r line <&"$1"; do
+        case $line in
+            .OK) return 0 ;;
+            .ERROR) return 1 ;;
+        esac
+        echo "$line"
+    done
+    return 1
+}
+
+rows=3000
+(
+    # in batches, so the reads below land in between
+    exec 3<>/dev/tcp/127.0.0.1/$port
+    for start in $(seq 0 100 $((rows - 1))); do
+        seq $start $((start + 99)) | sed 's/.*/INSERT INTO t &/' >&3
+        for _ in $(seq 100); do
+            response 3 > /dev/null || exit 1
+        done
+    done
+) &
+writer=$!
+
+exec 4<>/dev/tcp/127.0.0.1/$port || fail "server did not start"
+last=0
+while kill -0 $writer 2>/dev/null; do
+    printf 'SELECT id\nFROM t\nEND\n' >&4
+    response 4 > seen || fail "SELECT failed"
+    n=$(wc -l < seen)
+    [ "$n" -ge "$last" ] || fail "a read saw $n rows after one saw $last"
+    [ "$n" -eq 0 ] || seq 0 $((n - 1)) | cmp -s - seen || fail "a read of $n rows was not a prefix"
+    last=$n
+done
+wait $writer || fail "an insert failed"
+printf 'SELECT id\nFROM t\nEND\n' >&4
+[ "$(response 4 | wc -l)" -eq $rows ] || fail "the table does not hold all $rows rows"
+
+exec 5<>/dev/tcp/127.0.0.1/$port
+printf 'SELECT id, name\nFROM big\nEND\n' >&4
+read -r first <&4
+[ "$first" = "0,name0" ] || fail "first row was '$first'"
+printf 'CREATE TABLE big\nADD id int 8\nADD name char 20\nEND\n' >&5
+response 5 > /dev/null || fail "replacing the table failed"
+[ "$(response 4 | wc -l)" -eq 199999 ] || fail "the stream lost rows to the replace"
+printf 'SELECT id, name\nFROM big\nEND\n' >&4
+[ "$(response 4 | wc -l)" -eq 0 ] || fail "the replaced table still has rows"
+
+echo "PASS: $(basename "$0")"
@@ -0,0 +1,58 @@
+#!/bin/bash
+# A query sees the tombstones as of its start: rows another session deletes
+# while it streams its result are still returned, and the next query leaves
+# them out.
+db="$(cd "$(dirname "$0")/.." && pwd)/database"
+dir=$(mktemp -d)
+port=$((20000 + $$ % 20000))
+trap 'kill $server 2>/dev/null; rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+# enough rows that the result does not fit in the socket buffers
+rows=200000
+{
+    printf 'CREATE TABLE t\nADD id int 8\nADD name char 20\nEND\n'
+    seq 0 $((rows - 1)) | sed 's/.*/INSERT INTO t &,name&/'
+} | "$db" > /dev/null
+
+"$db" --listen $port > server.log 2>&1 &
+server=$!
+for _ in $(seq 50); do
+    (exec 3<>/dev/tcp/127.0.0.1/$port) 2>/dev/null && break
+    sleep 0.1
+done
+
+# Reads a response from fd $1 and prints its row count, or -1 if it failed.
+count_rows() {
+    local n=0 line
+    while read -r line <&"$1"; do
+        [ "$line" = .OK ] && break
+        [ "$line" = .ERROR ] && n=-1 && break
+        n=$((n + 1))
+    done
+    echo $n
+}
+
+exec 3<>/dev/tcp/127.0.0.1/$port || fail "server did not start"
+exec 4<>/dev/tcp/127.0.0.1/$port || fail "server did not start"
+
+printf 'SELECT id, name\nFROM t\nEND\n' >&3
+read -r first <&3
+[ "$first" = "0,name0" ] || fail "first row was '$first'"
+
+printf 'DELETE FROM t WHERE name = "name1"\nDELETE FROM t WHERE id = %d\n' $((rows - 1)) >&4
+[ "$(count_rows 4)" -eq 0 ] && [ "$(count_rows 4)" -eq 0 ] || fail "DELETE returned rows"
+
+n=$(count_rows 3)
+[ "$n" -eq $((rows - 1)) ] || fail "query running during the DELETE returned $((n + 1)) rows"
+
+printf 'SELECT id, name\nFROM t\nEND\n' >&3
+n=$(count_rows 3)
+[ "$n" -eq $((rows - 2)) ] || fail "query after the DELETE returned $n rows"
+
+echo "PASS: $(basename "$0")"
@@ -0,0 +1,65 @@
+#!/bin/sh
+# VACUUM writes the compacted table and hash indexes under .vacuum names and
+# commits by creating t.vacuum.commit. A table whose VACUUM crashed after the
+# commit opens with the compacted files, even if only some were renamed; one
+# whose VACUUM crashed before it opens unchanged, and the files are dropped.
+db="$(cd "$(dirname "$0")/.." && pwd)/database"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+mkdir before after
+cd before || exit 1
+"$db" <<'END_OF_INPUT'
+CREATE TABLE t
+ADD id char 10
+ADD city char 10 DICTIONARY
+END
+INSERT INTO t 0,x
+INSERT INTO t 1,y
+INSERT INTO t 2,x
+INSERT INTO t 3,z
+CREATE INDEX h USING HASH city, id
+FROM t
+END
+DELETE FROM t WHERE id = "1"
+END_OF_INPUT
+cp ./* ../after/
+cd ../after || exit 1
+printf 'VACUUM t\n' | "$db"
+[ ! -e t.vacuum.commit ] || fail "VACUUM left its commit marker"
+
+# An interrupted VACUUM that did not commit
+cd ../before || exit 1
+cp ./* ../
+cd .. || exit 1
+for f in zone dict zdir zblk bin del; do
+    cp "after/t.$f" "t.vacuum.$f"
+done
+printf 'SELECT id, city\nFROM t\nEND\n' | "$db" > out
+[ "$(tr '\n' ' ' < out)" = "0,x 2,x 3,z " ] || fail "uncommitted VACUUM changed the table: $(cat out)"
+[ -z "$(ls t.vacuum.* 2>/dev/null)" ] || fail "uncommitted VACUUM files were left"
+
+# A VACUUM that committed and renamed two of its files before the crash
+for f in zone dict zdir zblk bin del; do
+    cp "after/t.$f" "t.vacuum.$f"
+done
+cp after/h.hash h.vacuum.hash
+cp after/h.hash.ovf h.vacuum.hash.ovf
+: > t.vacuum.commit
+mv t.vacuum.zone t.zone
+mv t.vacuum.dict t.dict
+printf 'SELECT id, city\nFROM t\nEND\n' | "$db" > out
+[ "$(tr '\n' ' ' < out)" = "0,x 2,x 3,z " ] || fail "committed VACUUM returned $(cat out)"
+[ -z "$(ls t.vacuum.* h.vacuum.* 2>/dev/null)" ] || fail "committed VACUUM files were left"
+cmp -s t.bin after/t.bin || fail "t.bin is not the compacted one"
+cmp -s t.del after/t.del || fail "t.del is not the compacted one"
+out=$(printf 'SELECT city, id\nFROM h\nWHERE city = "x"\nEND\n' | "$db" | sort | tr '\n' ' ')
+[ "$out" = "x,0 x,2 " ] || fail "hash lookup after the committed VACUUM returned '$out'"
+
+echo "PASS: $(basename "$0")"